@@ -0,0 +1,749 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+
+#include <richtext/richtext.hpp>
+#include <richtext/formatters/markdown.hpp>
+
+
+namespace {
+
+  std::atomic<std::size_t> allocations{0};
+  std::atomic<std::size_t> allocated_bytes{0};
+
+}
+
+
+// The replacements below pair malloc with free. Once GCC inlines both into
+// a container it only sees free() on a pointer from operator new and warns
+// about a mismatch that isn't there.
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+
+
+void* operator new(std::size_t size) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+  if(void* p = std::malloc(size == 0 ? 1 : size))
+    return p;
+  throw std::bad_alloc{};
+}
+
+
+void* operator new(std::size_t size, std::align_val_t alignment) {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  allocated_bytes.fetch_add(size, std::memory_order_relaxed);
+  std::size_t const a = static_cast<std::size_t>(alignment);
+  if(void* p = std::aligned_alloc(a, (size + a - 1) / a * a))
+    return p;
+  throw std::bad_alloc{};
+}
+
+
+void operator delete(void* p, std::align_val_t) noexcept {
+  std::free(p);
+}
+
+
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept {
+  std::free(p);
+}
+
+
+void operator delete(void* p) noexcept {
+  std::free(p);
+}
+
+
+void operator delete(void* p, std::size_t) noexcept {
+  std::free(p);
+}
+
+
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic pop
+#endif
+
+
+namespace {
+
+  using clock_type = std::chrono::steady_clock;
+
+
+  // best of several runs, the sandboxes we run in are noisy
+  template<typename F>
+  double seconds(F&& f, int runs = 7) {
+    double best = 0;
+    for(int i = 0; i != runs; ++i) {
+      auto const started = clock_type::now();
+      f();
+      double const elapsed = std::chrono::duration<double>(clock_type::now() - started).count();
+      if(i == 0 || elapsed < best)
+        best = elapsed;
+    }
+    return best;
+  }
+
+
+  void report(char const* name, double elapsed, std::size_t bytes) {
+    std::printf("%-32s %10.3f ms %10.1f MB/s\n", name, elapsed * 1e3,
+                double(bytes) / elapsed / 1e6);
+  }
+
+
+  void report_build(char const* name, double elapsed, std::size_t allocated) {
+    std::printf("%-32s %10.3f ms %10zu allocations\n", name, elapsed * 1e3, allocated);
+  }
+
+
+  richtext::document large_document(richtext::pmr::allocator_type const& allocator = richtext::pmr::allocator()) {
+    using namespace richtext;
+    auto doc = document{ "Large", allocator };
+    auto table = richtext::table{ {"Id", "Name", "Value"}, allocator };
+    for(int i = 0; i != 200000; ++i)
+      table.add(table_row{ allocator }.add(std::to_string(i)).add("name").add("12.5"));
+    doc.add(std::move(table));
+    for(int i = 0; i != 10000; ++i) {
+      auto p = paragraph{ allocator };
+      for(int j = 0; j != 100; ++j)
+        p.add(j % 3 == 0 ? tag::emphasis : tag::normal, "word ");
+      doc.add(std::move(p));
+    }
+    return doc;
+  }
+
+
+  void large_model() {
+    using namespace richtext;
+    double build = 0;
+    std::size_t allocated = 0;
+    for(int i = 0; i != 3; ++i) {
+      auto const before = allocations.load();
+      auto const started = clock_type::now();
+      {
+        auto doc = large_document();
+      }
+      double const elapsed = std::chrono::duration<double>(clock_type::now() - started).count();
+      allocated = allocations.load() - before;
+      if(i == 0 || elapsed < build)
+        build = elapsed;
+    }
+    report_build("build + free 200k rows + 1M spans", build, allocated);
+
+    build = 0;
+    {
+      pmr::arena arena{ std::size_t(320) << 20 };
+      for(int i = 0; i != 3; ++i) {
+        auto const before = allocations.load();
+        auto const started = clock_type::now();
+        {
+          auto doc = large_document(arena.allocator());
+        }
+        arena.reset();
+        double const elapsed = std::chrono::duration<double>(clock_type::now() - started).count();
+        allocated = allocations.load() - before;
+        if(i == 0 || elapsed < build)
+          build = elapsed;
+      }
+    }
+    report_build("build + free in reused arena", build, allocated);
+
+    auto const doc = large_document();
+    formatters::markdown md;
+    auto const elapsed = seconds([&] { md.clear(); md.render(doc); }, 3);
+    report("render 200k rows + 1M spans", elapsed, md.size());
+  }
+
+
+  richtext::flat_document large_flat_document() {
+    using namespace richtext;
+    auto builder = flat_document::builder{ "Large" };
+    builder.table({"Id", "Name", "Value"});
+    for(int i = 0; i != 200000; ++i)
+      builder.row().add(std::to_string(i)).add("name").add("12.5");
+    for(int i = 0; i != 10000; ++i) {
+      builder.paragraph();
+      for(int j = 0; j != 100; ++j)
+        builder.add(j % 3 == 0 ? tag::emphasis : tag::normal, "word ");
+    }
+    return builder.build();
+  }
+
+
+  void flat_model() {
+    using namespace richtext;
+    double build = 0;
+    std::size_t allocated = 0;
+    for(int i = 0; i != 3; ++i) {
+      auto const before = allocations.load();
+      auto const started = clock_type::now();
+      {
+        auto doc = large_flat_document();
+      }
+      double const elapsed = std::chrono::duration<double>(clock_type::now() - started).count();
+      allocated = allocations.load() - before;
+      if(i == 0 || elapsed < build)
+        build = elapsed;
+    }
+    report_build("build + free flat document", build, allocated);
+
+    auto const doc = large_flat_document();
+    formatters::markdown md;
+    auto const elapsed = seconds([&] { md.clear(); md.render(doc); }, 3);
+    report("render flat document", elapsed, md.size());
+  }
+
+
+  // bytes requested while building a table of mostly short cells,
+  // growth of the row and table vectors included
+  void million_cells() {
+    using namespace richtext;
+    char const* const cells[] = { "OK", "12.5", "n/a", "failed", "2021-06-01", "a longer cell text here" };
+    auto const started = clock_type::now();
+    auto const before = allocations.load();
+    auto const bytes = allocated_bytes.load();
+    {
+      auto table = richtext::table{ {"Status", "Value", "Note", "Date"} };
+      for(int i = 0; i != 250000; ++i)
+        table.add(table_row{}
+          .add(cells[i % 6]).add(cells[(i + 1) % 6])
+          .add(cells[(i + 2) % 6]).add(cells[(i + 3) % 6]));
+    }
+    double const elapsed = std::chrono::duration<double>(clock_type::now() - started).count();
+    std::printf("%-32s %10.3f ms %10zu allocations %8.1f MB, span is %zu bytes\n",
+                "build + free 1M cells", elapsed * 1e3, allocations.load() - before,
+                double(allocated_bytes.load() - bytes) / 1e6, sizeof(span));
+  }
+
+
+  // per-cell cost of virtual hooks against the statically dispatched ones
+  void dispatch() {
+    using namespace richtext;
+    auto table = richtext::table{ {"A", "B", "C", "D"} };
+    for(int i = 0; i != 250000; ++i)
+      table.add(table_row{}.add("ok").add(i).add("n/a").add(tag::strong, "x"));
+    auto const doc = document{}.add(std::move(table));
+    std::size_t const cells = 1000000;
+
+    formatters::markdown dynamic;
+    auto const virtual_calls = seconds([&] { dynamic.clear(); dynamic.render(doc); });
+    formatters::static_markdown fixed;
+    auto const static_calls = seconds([&] { fixed.clear(); fixed.render(doc); });
+    std::printf("%-32s %10.3f ms %8.2f ns/cell\n", "1M cells, virtual hooks",
+                virtual_calls * 1e3, virtual_calls * 1e9 / double(cells));
+    std::printf("%-32s %10.3f ms %8.2f ns/cell\n", "1M cells, static hooks",
+                static_calls * 1e3, static_calls * 1e9 / double(cells));
+  }
+
+
+  void numeric_cells() {
+    using namespace richtext;
+    auto const build = [](bool typed) {
+      auto table = richtext::table{ {"Id", "Count", "Price"} };
+      for(int i = 0; i != 200000; ++i) {
+        std::int64_t const id = 1000000007ll * i;
+        double const price = i * 0.37;
+        if(typed)
+          table.add(table_row{}.add(id).add(std::uint64_t(i)).add(price, 2));
+        else {
+          char buffer[32];
+          std::snprintf(buffer, sizeof(buffer), "%.2f", price);
+          table.add(table_row{}.add(std::to_string(id)).add(std::to_string(i)).add(buffer));
+        }
+      }
+      return document{}.add(std::move(table));
+    };
+
+    for(bool const typed: {false, true}) {
+      formatters::markdown md;
+      std::size_t allocated = 0;
+      auto const elapsed = seconds([&] {
+        auto const before = allocations.load();
+        md.clear();
+        md.render(build(typed));
+        allocated = allocations.load() - before;
+      }, 5);
+      std::printf("%-32s %10.3f ms %10zu allocations\n",
+                  typed ? "build + render 600k numbers" : "build + render 600k strings",
+                  elapsed * 1e3, allocated);
+    }
+  }
+
+
+  void columnar() {
+    using namespace richtext;
+    std::size_t const rows = 100000, columns = 20;
+    std::vector<std::vector<double>> values(columns);
+    for(std::size_t c = 0; c != columns; ++c)
+      for(std::size_t r = 0; r != rows; ++r)
+        values[c].push_back(double(r * (c + 1)) * 0.01);
+
+    for(bool const by_column: {false, true}) {
+      formatters::markdown md;
+      std::size_t allocated = 0;
+      auto const elapsed = seconds([&] {
+        auto const before = allocations.load();
+        md.clear();
+        if(by_column) {
+          auto table = columnar_table{};
+          for(std::size_t c = 0; c != columns; ++c)
+            table.add_column("Metric", values[c], 2);
+          md.render(document{}.add(std::move(table)));
+        } else {
+          auto table = richtext::table{ table_header(columns, "Metric") };
+          for(std::size_t r = 0; r != rows; ++r) {
+            auto row = table_row{};
+            for(std::size_t c = 0; c != columns; ++c)
+              row.add(values[c][r], 2);
+            table.add(std::move(row));
+          }
+          md.render(document{}.add(std::move(table)));
+        }
+        allocated = allocations.load() - before;
+      }, 5);
+      std::printf("%-32s %10.3f ms %10zu allocations\n",
+                  by_column ? "columnar 100k x 20 doubles" : "rows 100k x 20 doubles",
+                  elapsed * 1e3, allocated);
+    }
+  }
+
+
+  void lazy_rows() {
+    using namespace richtext;
+    int const rows = 1000000;
+    for(bool const lazy: {false, true}) {
+      formatters::markdown md;
+      std::size_t allocated = 0, bytes = 0;
+      auto const elapsed = seconds([&] {
+        auto const before = allocations.load();
+        auto const before_bytes = allocated_bytes.load();
+        md.clear();
+        if(lazy) {
+          md.render(document{}.add(lazy_table{ {"Id", "Name", "Value"}, [] {
+            return lazy_table::generator_type{ [i = 0](table_row& row) mutable {
+              if(i == rows)
+                return false;
+              row.add(i).add("a name long enough for the heap").add(i * 0.5, 1);
+              ++i;
+              return true;
+            } };
+          } }));
+        } else {
+          auto table = richtext::table{ {"Id", "Name", "Value"} };
+          for(int i = 0; i != rows; ++i)
+            table.add(table_row{}.add(i).add("a name long enough for the heap").add(i * 0.5, 1));
+          md.render(document{}.add(std::move(table)));
+        }
+        allocated = allocations.load() - before;
+        bytes = allocated_bytes.load() - before_bytes;
+      }, 3);
+      std::printf("%-32s %10.3f ms %10zu allocations %8.1f MB\n",
+                  lazy ? "lazy 1M rows" : "materialized 1M rows",
+                  elapsed * 1e3, allocated, double(bytes) / 1e6);
+    }
+  }
+
+
+  void streaming() {
+    using namespace richtext;
+    int const rows = 1000000;
+    std::size_t written = 0;
+    for(bool const stream: {false, true}) {
+      formatters::markdown md;
+      std::size_t allocated = 0;
+      auto const elapsed = seconds([&] {
+        auto const before = allocations.load();
+        md.clear();
+        written = 0;
+        if(stream) {
+          writer w{ md, [&](std::string_view chunk) { written += chunk.size(); }, "Audit" };
+          w.begin_table({"Id", "Event"});
+          for(int i = 0; i != rows; ++i)
+            w.row(table_row{}.add(i).add("event"));
+          w.finish();
+        } else {
+          auto table = richtext::table{ {"Id", "Event"} };
+          for(int i = 0; i != rows; ++i)
+            table.add(table_row{}.add(i).add("event"));
+          md.render(document{ "Audit" }.add(std::move(table)));
+          written = md.size();
+        }
+        allocated = allocations.load() - before;
+      }, 3);
+      std::printf("%-32s %10.3f ms %10zu allocations %8.1f MB output buffer\n",
+                  stream ? "streamed 1M rows" : "tree 1M rows", elapsed * 1e3, allocated,
+                  double(md.string().committed_capacity()) / 1e6);
+    }
+  }
+
+
+  // the same boilerplate section repeated across many documents
+  void shared_sections() {
+    using namespace richtext;
+    int const documents = 1000;
+    auto const build = [] {
+      auto legal = section{ "Terms and conditions" };
+      for(int i = 0; i != 200; ++i)
+        legal.add(paragraph{}.add(tag::strong, "Clause " + std::to_string(i))
+                    .add(": the service is provided as is, without any warranty"));
+      return legal;
+    };
+    auto const shared = std::make_shared<section const>(build());
+
+    for(int mode = 0; mode != 3; ++mode) {
+      formatters::markdown md;
+      md.cache_shared(mode == 2);
+      std::size_t allocated = 0;
+      auto const elapsed = seconds([&] {
+        auto const before = allocations.load();
+        md.clear();
+        for(int i = 0; i != documents; ++i) {
+          auto doc = document{ "Report" }.add(paragraph{}.add("document " + std::to_string(i)));
+          if(mode == 0)
+            doc.add(build());
+          else
+            doc.add(shared);
+          md.render(doc);
+        }
+        allocated = allocations.load() - before;
+      }, 3);
+      char const* const names[] = { "1k docs, rebuilt section", "1k docs, shared section",
+                                    "1k docs, shared + cached" };
+      std::printf("%-32s %10.3f ms %10zu allocations %8.1f MB\n", names[mode],
+                  elapsed * 1e3, allocated, double(md.size()) / 1e6);
+    }
+  }
+
+
+  // same report shape every time, a few hundred values differ
+  void templates() {
+    using namespace richtext;
+    int const instances = 1000;
+    int const values = 300;
+    std::vector<std::string> names;
+    for(int i = 0; i != values; ++i)
+      names.push_back("value" + std::to_string(i));
+
+    auto const build = [&](int instance, bool slots) {
+      auto doc = document{ "Report" };
+      for(int s = 0; s != 10; ++s) {
+        auto part = section{ "Part " + std::to_string(s) };
+        for(int p = 0; p != 30; ++p) {
+          auto text = paragraph{}.add("Figure ").add(tag::strong, "of the day")
+                        .add(" is stated in the accompanying notes: ");
+          int const i = s * 30 + p;
+          if(slots)
+            text.add_slot(names[i]);
+          else
+            text.add(span{ tag::normal, std::int64_t(instance + i) });
+          part.add(std::move(text));
+        }
+        auto table = richtext::table{ {"Key", "Description"} };
+        for(int r = 0; r != 50; ++r)
+          table.add(table_row{}.add(r).add("fixed description of the row"));
+        part.add(std::move(table));
+        doc.add(std::move(part));
+      }
+      return doc;
+    };
+
+    for(bool const compiled: {false, true}) {
+      formatters::markdown md;
+      std::unique_ptr<document_template> report;
+      if(compiled)
+        report = std::make_unique<document_template>(md, build(0, true));
+      std::size_t allocated = 0;
+      auto const elapsed = seconds([&] {
+        auto const before = allocations.load();
+        md.clear();
+        for(int n = 0; n != instances; ++n) {
+          if(compiled) {
+            for(int i = 0; i != values; ++i)
+              report->set(std::size_t(i), n + i);
+            report->render();
+          } else
+            md.render(build(n, false));
+        }
+        allocated = allocations.load() - before;
+      }, 3);
+      std::printf("%-32s %10.3f ms %10zu allocations %8.1f MB\n",
+                  compiled ? "1k reports from a template" : "1k reports rebuilt",
+                  elapsed * 1e3, allocated, double(md.size()) / 1e6);
+    }
+  }
+
+
+  // a refreshed dashboard where ~2% of the cells change per tick
+  void dashboard() {
+    using namespace richtext;
+    int const rows = 10000;
+    int const ticks = 10;
+    auto const build = [&](int tick) {
+      auto table = richtext::table{ {"Service", "Host", "Latency", "Status"} };
+      for(int i = 0; i != rows; ++i)
+        table.add(table_row{}.add("service-" + std::to_string(i)).add("host.example.org")
+                    .add(i % 50 == 0 ? tick + i : i).add("ok"));
+      return document{ "Dashboard" }.add(section{ "Services" }.add(std::move(table)));
+    };
+
+    for(bool const mutate: {false, true}) {
+      formatters::markdown md;
+      auto live = build(0);
+      std::size_t allocated = 0;
+      auto const elapsed = seconds([&] {
+        auto const before = allocations.load();
+        for(int tick = 1; tick <= ticks; ++tick) {
+          md.clear();
+          if(mutate) {
+            auto& table = *live.at(0).section()->at(0).table();
+            for(int i = 0; i < rows; i += 50)
+              table.set_cell(std::size_t(i), 2, span{ tag::normal, std::int64_t(tick + i) });
+            md.render(live);
+          } else
+            md.render(build(tick));
+        }
+        allocated = allocations.load() - before;
+      }, 3);
+      std::printf("%-32s %10.3f ms %10zu allocations\n",
+                  mutate ? "10 ticks, cells set in place" : "10 ticks, dashboard rebuilt",
+                  elapsed * 1e3, allocated);
+    }
+  }
+
+
+  // dependency trees: many lists nested a few dozen levels deep
+  void nested_lists() {
+    using namespace richtext;
+    auto doc = document{ "Dependencies" };
+    for(int tree = 0; tree != 2000; ++tree) {
+      auto list = unordered_list{}.add(paragraph{ "leaf" });
+      for(int level = 0; level != 50; ++level)
+        list = unordered_list{}.add(paragraph{ "package" }).add(std::move(list))
+                 .add(paragraph{ "sibling" });
+      doc.add(std::move(list));
+    }
+    formatters::markdown md{ formatters::markdown_options{}.indent(1) };
+    auto const elapsed = seconds([&] { md.clear(); md.render(doc); });
+    report("render 2k trees 50 levels deep", elapsed, md.size());
+  }
+
+
+  // a report of 2000 top-level sections spread over a growing pool
+  void parallel_sections() {
+    using namespace richtext;
+    auto doc = document{ "Report" };
+    for(int s = 0; s != 2000; ++s) {
+      auto table = richtext::table{ {"Id", "Name", "Value"} };
+      for(int r = 0; r != 200; ++r)
+        table.add(table_row{}.add(r).add("a cell with_some *escapes*").add(r * 0.25, 2));
+      doc.add(section{ "Section " + std::to_string(s) }
+        .add(paragraph{}.add("Intro ").add(tag::strong, "text"))
+        .add(std::move(table)));
+    }
+
+    formatters::markdown md;
+    auto const serial = seconds([&] { md.clear(); md.render(doc); }, 3);
+    report("2k sections, serial", serial, md.size());
+    for(std::size_t threads: {1, 2, 4, 8, 16, 32}) {
+      auto const elapsed = seconds([&] {
+        md.clear();
+        md.render(doc, threads, [] { return std::make_unique<formatters::markdown>(); });
+      }, 3);
+      char name[64];
+      std::snprintf(name, sizeof(name), "2k sections, %zu threads", threads);
+      report(name, elapsed, md.size());
+    }
+  }
+
+
+  // consecutive runs of a report where only the header section changes
+  void render_cache() {
+    using namespace richtext;
+    auto const build = [](int run) {
+      auto doc = document{ "Report" }
+        .add(section{ "Header" }.add(paragraph{}.add("Run ").add(tag::strong, std::to_string(run))));
+      for(int s = 0; s != 200; ++s) {
+        auto table = richtext::table{ {"Id", "Name", "Value"} };
+        for(int r = 0; r != 100; ++r)
+          table.add(table_row{}.add(s * 100 + r).add("a cell with_some *escapes*").add(r * 0.25, 2));
+        doc.add(section{ "Section " + std::to_string(s) }.add(std::move(table)));
+      }
+      return doc;
+    };
+
+    for(bool const cached: {false, true}) {
+      formatters::markdown md;
+      md.cache_budget(cached ? 64 << 20 : 0);
+      md.render(build(0));
+      int run = 1;
+      double rendering = 0;
+      auto const elapsed = seconds([&] {
+        auto const doc = build(run++);
+        auto const started = clock_type::now();
+        md.clear();
+        md.render(doc);
+        rendering = std::chrono::duration<double>(clock_type::now() - started).count();
+      }, 3);
+      auto const& stats = md.cache_stats();
+      std::printf("%-32s %10.3f ms %10.3f ms render %6zu hits %6zu misses\n",
+                  cached ? "next run, content cache" : "next run, uncached",
+                  elapsed * 1e3, rendering * 1e3, stats.hits, stats.misses);
+    }
+  }
+
+
+  // a dashboard of about 50 MB where one cell changes between refreshes
+  void live_dashboard() {
+    using namespace richtext;
+    auto doc = document{ "Dashboard" };
+    for(int s = 0; s != 1000; ++s) {
+      auto table = richtext::table{ {"Id", "Name", "Value"} };
+      for(int r = 0; r != 1000; ++r)
+        table.add(table_row{}.add(s * 1000 + r).add("a cell with_some *escapes*").add(r * 0.25, 2));
+      doc.add(section{ "Section " + std::to_string(s) }.add(std::move(table)));
+    }
+    auto& cells = *doc.at(500).section()->at(0).table();
+
+    formatters::markdown md;
+    auto const full = seconds([&] {
+      md.clear();
+      md.render(doc);
+    }, 3);
+    std::printf("%-32s %10.3f ms %10.1f MB\n", "full render", full * 1e3, md.size() / 1e6);
+
+    formatters::markdown scratch;
+    live_output live{ scratch, doc };
+    live.refresh();
+    int tick = 0;
+    auto const refresh = seconds([&] {
+      cells.set_cell(tick % 1000, 2, span{ tag::normal, tick * 0.5, 2 });
+      ++tick;
+      live.refresh();
+    });
+    std::printf("%-32s %10.3f ms %10.1f MB\n", "live refresh, one cell", refresh * 1e3, live.size() / 1e6);
+  }
+
+
+  void changelog() {
+    using namespace richtext;
+    auto const build = [] {
+      auto list = unordered_list{ "Changes" };
+      for(int i = 0; i != 100000; ++i) {
+        if(i % 100 == 0)
+          list.add(ordered_list{}.add(paragraph{ "nested entry" }));
+        list.add(paragraph{}.add(tag::strong, "fix").add(": entry"));
+      }
+      return document{ "Changelog" }.add(std::move(list));
+    };
+
+    double best = 0;
+    std::size_t allocated = 0;
+    for(int i = 0; i != 5; ++i) {
+      auto const before = allocations.load();
+      auto const started = clock_type::now();
+      {
+        auto doc = build();
+      }
+      double const elapsed = std::chrono::duration<double>(clock_type::now() - started).count();
+      allocated = allocations.load() - before;
+      if(i == 0 || elapsed < best)
+        best = elapsed;
+    }
+    report_build("build + free 100k bullets", best, allocated);
+
+    auto const doc = build();
+    formatters::markdown md;
+    auto const elapsed = seconds([&] { md.clear(); md.render(doc); });
+    report("render 100k bullets", elapsed, md.size());
+  }
+
+
+  // cells sliced out of a buffer the caller already holds, too long for SSO
+  void borrowed_cells() {
+    using namespace richtext;
+    std::string buffer;
+    for(int i = 0; i != 1000; ++i)
+      buffer += "result-" + std::to_string(1000000 + i) + "-with-a-long-suffix|";
+    std::string_view const data{ buffer };
+    std::size_t const width = data.size() / 1000;
+
+    auto const build = [&](bool ref) {
+      auto table = richtext::table{ {"A", "B", "C"} };
+      for(std::size_t i = 0; i != 200000; ++i) {
+        auto const cell = data.substr(i % 1000 * width, width - 1);
+        auto row = table_row{};
+        if(ref)
+          row.add_ref(cell).add_ref(cell).add_ref(cell);
+        else
+          row.add(cell).add(cell).add(cell);
+        table.add(std::move(row));
+      }
+      return document{}.add(std::move(table));
+    };
+
+    for(bool const ref: {false, true}) {
+      double best = 0;
+      std::size_t allocated = 0;
+      for(int i = 0; i != 5; ++i) {
+        auto const before = allocations.load();
+        auto const started = clock_type::now();
+        auto doc = build(ref);
+        double const elapsed = std::chrono::duration<double>(clock_type::now() - started).count();
+        allocated = allocations.load() - before;
+        if(i == 0 || elapsed < best)
+          best = elapsed;
+      }
+      report_build(ref ? "build 600k borrowed cells" : "build 600k owned cells", best, allocated);
+    }
+  }
+
+
+  void escape_heavy() {
+    using namespace richtext;
+    auto doc = document{ "Escapes" };
+    for(int i = 0; i != 2000; ++i) {
+      auto p = paragraph{};
+      for(int j = 0; j != 50; ++j)
+        p.add(j % 2 == 0 ? tag::normal : tag::strong, "a_b*c[d]e|f#g`h\\i{j}k plain words");
+      doc.add(std::move(p));
+    }
+    auto table = richtext::table{ {"Key", "Value"} };
+    for(int i = 0; i != 50000; ++i)
+      table.add(table_row{}.add("row_" + std::to_string(i)).add("[*" + std::to_string(i) + "*]"));
+    doc.add(std::move(table));
+
+    formatters::markdown md;
+    auto const elapsed = seconds([&] { md.clear(); md.render(doc); });
+    report("escape-heavy document", elapsed, md.size());
+  }
+
+}
+
+
+int main() {
+  escape_heavy();
+  large_model();
+  flat_model();
+  borrowed_cells();
+  changelog();
+  million_cells();
+  numeric_cells();
+  columnar();
+  lazy_rows();
+  streaming();
+  shared_sections();
+  templates();
+  dashboard();
+  dispatch();
+  nested_lists();
+  parallel_sections();
+  render_cache();
+  live_dashboard();
+  return 0;
+}
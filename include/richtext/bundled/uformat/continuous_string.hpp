@@ -1,7 +1,9 @@
 #pragma once
 
 
+#include <atomic>
 #include <cstdint>
+#include <cstring>
 #include <string_view>
 #include <string>
 #include <stdexcept>
@@ -25,6 +27,16 @@
 #include <memoryapi.h>
 #include <handleapi.h>
 
+#elif defined(__unix__) || defined(__APPLE__)
+
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#endif
+
 #else
   
 #error Unsupported system
@@ -34,6 +46,34 @@
 
 
 namespace uformat {
+
+
+enum class pages {
+  regular, // system page size
+  huge,    // 2 MiB aligned reservation and commits, transparent huge pages where available
+  memfd    // shared memory file that can be handed to other processes, see seal(); Linux only
+};
+
+
+// Page faults the calling thread has taken so far, minor and major, to be
+// read before and after some work. Counted for the whole process where
+// the system has no per-thread count, and not at all on Windows, where
+// this stays zero.
+inline std::uint64_t page_faults() noexcept {
+#if defined(_WIN32)
+  return 0;
+#else
+  rusage usage;
+#if defined(RUSAGE_THREAD)
+  if(getrusage(RUSAGE_THREAD, &usage) != 0)
+    return 0;
+#else
+  if(getrusage(RUSAGE_SELF, &usage) != 0)
+    return 0;
+#endif
+  return std::uint64_t(usage.ru_minflt) + std::uint64_t(usage.ru_majflt);
+#endif
+}
   
 
 template<std::uint64_t MCAP = 2147483648>
@@ -51,13 +91,162 @@ public:
   using const_iterator = char const*;
     
   static constexpr size_type npos = size_type(-1);
+  static constexpr size_type huge_page_size = 2097152;
+  
+  
+  // Recycles reserved regions between strings instead of unmapping them.
+  // Regions go to a per-thread cache first and then to a lock-free global
+  // list; a region is unmapped only when both are full.
+  class region_pool {
+  public:
+  
+    static constexpr std::size_t max_regions = 64;
+    static constexpr std::size_t max_thread_regions = 8;
+    static constexpr std::size_t default_capacity = 16;
+    static constexpr std::size_t default_thread_capacity = 4;
+    static constexpr size_type default_retained_bytes = 1048576;
+    
+    
+    constexpr region_pool() noexcept = default;
+    region_pool(region_pool const&) = delete;
+    region_pool& operator = (region_pool const&) = delete;
+    
+    std::size_t capacity() const noexcept { return capacity_.load(std::memory_order_relaxed); }
+    std::size_t thread_capacity() const noexcept { return thread_capacity_.load(std::memory_order_relaxed); }
+    size_type retained_bytes() const noexcept { return retained_bytes_.load(std::memory_order_relaxed); }
+    std::uint64_t hits() const noexcept { return hits_.load(std::memory_order_relaxed); }
+    std::uint64_t misses() const noexcept { return misses_.load(std::memory_order_relaxed); }
+    
+    
+    // regions kept in the global list, up to max_regions
+    region_pool& capacity(std::size_t n) noexcept {
+      capacity_.store(n < max_regions ? n : max_regions, std::memory_order_relaxed);
+      return *this;
+    }
+    
+    
+    // regions kept by each thread, up to max_thread_regions
+    region_pool& thread_capacity(std::size_t n) noexcept {
+      thread_capacity_.store(n < max_thread_regions ? n : max_thread_regions,
+                             std::memory_order_relaxed);
+      return *this;
+    }
+    
+    
+    // regions with more bytes committed are shrunk before they are pooled
+    region_pool& retained_bytes(size_type n) noexcept {
+      retained_bytes_.store(n, std::memory_order_relaxed);
+      return *this;
+    }
+    
+  private:
+  
+    friend class continuous_string;
+  
+    struct thread_cache {
+      char* regions[max_thread_regions];
+      std::size_t count;
+      bool closed;
+    };
+    
+    
+    // returns thread's regions to the global lists when the thread exits
+    struct thread_cache_guard {
+      ~thread_cache_guard() {
+        flush(uformat::pages::regular);
+        flush(uformat::pages::huge);
+      }
+      
+      static void flush(enum pages pages) noexcept {
+        auto& pool = continuous_string::pool(pages);
+        auto& cache = pool.local_cache();
+        cache.closed = true;
+        while(cache.count != 0) {
+          char* const region = cache.regions[--cache.count];
+          if(!pool.push(region))
+            release_pages(region, reservation_size(pages));
+        }
+      }
+    };
+    
+    
+    std::atomic<char*> regions_[max_regions]{};
+    std::atomic<std::size_t> capacity_{default_capacity};
+    std::atomic<std::size_t> thread_capacity_{default_thread_capacity};
+    std::atomic<size_type> retained_bytes_{default_retained_bytes};
+    std::atomic<std::uint64_t> hits_{0};
+    std::atomic<std::uint64_t> misses_{0};
+    
+    
+    thread_cache& local_cache() noexcept {
+      // trivially destructible, so it is still usable after the guard has run
+      thread_local thread_cache caches[2]{};
+      return caches[this == &continuous_string::pool(uformat::pages::huge)];
+    }
+    
+    
+    bool push(char* region) noexcept {
+      std::size_t const n = capacity();
+      for(std::size_t i = 0; i != n; ++i) {
+        char* expected = nullptr;
+        if(regions_[i].compare_exchange_strong(expected, region, std::memory_order_release,
+                                               std::memory_order_relaxed))
+          return true;
+      }
+      return false;
+    }
+    
+    
+    char* pop() noexcept {
+      for(std::size_t i = 0; i != max_regions; ++i) {
+        if(regions_[i].load(std::memory_order_relaxed) == nullptr)
+          continue;
+        if(char* region = regions_[i].exchange(nullptr, std::memory_order_acquire))
+          return region;
+      }
+      return nullptr;
+    }
+    
+    
+    // the committed size travels in the first bytes of a pooled region
+    char* acquire(size_type& committed) noexcept {
+      auto& cache = local_cache();
+      char* region = cache.count != 0 ? cache.regions[--cache.count] : pop();
+      if(region == nullptr) {
+        misses_.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+      }
+      hits_.fetch_add(1, std::memory_order_relaxed);
+      std::memcpy(&committed, region, sizeof(committed));
+      return region;
+    }
+    
+    
+    bool recycle(char* region, size_type committed) noexcept {
+      std::memcpy(region, &committed, sizeof(committed));
+      auto& cache = local_cache();
+      if(!cache.closed && cache.count < thread_capacity()) {
+        thread_local thread_cache_guard guard;
+        cache.regions[cache.count++] = region;
+        return true;
+      }
+      return push(region);
+    }
+  };
+  
+  
+  static region_pool& pool(enum pages pages) noexcept {
+    static region_pool regular, huge;
+    return pages == uformat::pages::huge ? huge : regular;
+  }
   
   
   continuous_string() noexcept { reserve(); }  
+  explicit continuous_string(enum pages pages) noexcept: pages_{pages} { reserve(); }
   ~continuous_string() { dispose(); }
   
   
-  continuous_string(continuous_string const& other) noexcept {
+  continuous_string(continuous_string const& other) noexcept: pages_{other.pages_} {
     if(!reserve() || !commit(other.size()))
       return;
     std::memcpy(data_, other.data_, other.size_);
@@ -75,8 +264,11 @@ public:
   
   
   continuous_string(continuous_string&& other) noexcept:
+    pages_{other.pages_}, commits_{other.commits_}, fd_{other.fd_},
     reserved_capacity_{other.reserved_capacity_}, committed_capacity_{other.committed_capacity_},
     size_{other.size_}, data_{other.data_} {    
+    other.commits_ = 0;
+    other.fd_ = -1;
     other.reserved_capacity_ = 0;
     other.committed_capacity_ = 0;
     other.size_ = 0;
@@ -86,6 +278,9 @@ public:
   
   continuous_string& operator = (continuous_string&& other) noexcept {
     dispose();
+    pages_ = other.pages_;
+    commits_ = other.commits_; other.commits_ = 0;
+    fd_ = other.fd_; other.fd_ = -1;
     reserved_capacity_ = other.reserved_capacity_; other.reserved_capacity_ = 0;
     committed_capacity_ = other.committed_capacity_; other.committed_capacity_ = 0;
     size_ = other.size_; other.size_ = 0;
@@ -168,7 +363,11 @@ public:
   size_type capacity() const noexcept { return reserved_capacity_ - 1; }
   size_type max_size() const noexcept { return reserved_capacity_ - 1; }
   bool empty() const noexcept { return size_ == 0; }
-  void clear() noexcept { size_ = 0; data_[0] = '\0'; }
+  void clear() noexcept { size_ = 0; if(data_ != nullptr) data_[0] = '\0'; }
+  enum pages pages() const noexcept { return pages_; }
+  size_type committed_capacity() const noexcept { return committed_capacity_; }
+  // number of times pages were committed, the initial page included
+  size_type commits() const noexcept { return commits_; }
   
   
   bool reserve(size_type new_capacity) noexcept {
@@ -185,13 +384,81 @@ public:
     if(new_capacity > reserved_capacity_)
       return false;
     
-    auto committed = commit_pages(&data_[committed_capacity_],
-                                new_capacity - committed_capacity_);
-    if(committed == nullptr)
-      return false;
-    
-    committed_capacity_ = new_capacity;
-    return true;   
+    return grow(new_capacity);
+  }
+  
+  
+  // decommits pages past the current size, keeping at least one granule
+  void shrink_to_fit() noexcept { shrink_to(0); }
+  
+  
+  // decommits pages past the given capacity, rounded down to a power of 2,
+  // keeping the current contents and at least one granule
+  void shrink_to(size_type capacity) noexcept {
+    if(capacity >= committed_capacity_)
+      return;
+    size_type keep = nearest_power_of_2(capacity + 1);
+    if(keep > capacity)
+      keep /= 2;
+    if(keep < size_ + 1)
+      keep = nearest_power_of_2(size_ + 1);
+    if(keep < granule_size())
+      keep = granule_size();
+    if(keep >= committed_capacity_)
+      return;
+#if defined(__linux__)
+    if(fd_ != -1) {
+      if(ftruncate(fd_, static_cast<off_t>(keep)) == 0)
+        committed_capacity_ = keep;
+      return;
+    }
+#endif
+    decommit_pages(&data_[keep], committed_capacity_ - keep);
+    committed_capacity_ = keep;
+  }
+  
+  
+  // memfd backing file, -1 for other modes
+  int fd() const noexcept { return fd_; }
+  
+  
+  // Trims the memfd backing file to the string contents, seals it against
+  // any further change and hands it over to the caller, who must close it.
+  // The string starts over empty with a new file, or with no storage at all
+  // if that cannot be had. Returns -1 if the string is not backed by memfd
+  // or on failure, which leaves the string and its contents as they were.
+  int seal() noexcept {
+#if defined(__linux__)
+    if(fd_ == -1)
+      return -1;
+    if(ftruncate(fd_, static_cast<off_t>(size_)) != 0)
+      return -1;
+    // F_SEAL_WRITE is refused while a writable mapping exists
+    release_pages(data_, reserved_capacity_);
+    data_ = nullptr;
+    if(fcntl(fd_, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) != 0) {
+      if(ftruncate(fd_, static_cast<off_t>(committed_capacity_)) == 0)
+        data_ = map_file(fd_, reserved_capacity_);
+      if(data_ == nullptr) {
+        close(fd_);
+        fd_ = -1;
+        reserved_capacity_ = 0;
+        committed_capacity_ = 0;
+        size_ = 0;
+        reserve();
+      }
+      return -1;
+    }
+    int const sealed = fd_;
+    fd_ = -1;
+    reserved_capacity_ = 0;
+    committed_capacity_ = 0;
+    size_ = 0;
+    reserve();
+    return sealed;
+#else
+    return -1;
+#endif
   }
   
   
@@ -332,7 +599,7 @@ public:
   }
 
   bool push_back(char c) noexcept {
-    if(size_ + 1 == committed_capacity_ && !commit(committed_capacity_ + 1))
+    if(size_ + 1 >= committed_capacity_ && !commit(committed_capacity_ + 1))
       return false;
     data_[size_] = c;
     ++size_;
@@ -341,7 +608,7 @@ public:
   
   
   bool push_back(wchar_t c) noexcept {
-    if(size_ + 1 == committed_capacity_ && !commit(committed_capacity_ + 1))
+    if(size_ + 1 >= committed_capacity_ && !commit(committed_capacity_ + 1))
       return false;
     // TODO: utf-8 conversion
     data_[size_] = c;    
@@ -408,7 +675,7 @@ public:
       return npos;
     for(char const *p = data_ + i, *e = data_ + size_; p != e; ++p)
       if(*p == c)
-        return static_cast<size_type>(p - p_);
+        return static_cast<size_type>(p - data_);
     return npos;
   }
 
@@ -427,7 +694,7 @@ public:
   
   
   std::string_view substr(size_type pos, size_type n) const noexcept {
-    return std::string_view{p_ + pos, n};
+    return std::string_view{data_ + pos, n};
   }
   
     
@@ -473,6 +740,9 @@ public:
 
 private:
 
+  enum pages pages_{uformat::pages::regular};
+  size_type commits_{0};
+  int fd_{-1};
   size_type reserved_capacity_{0};
   size_type committed_capacity_{0};
   size_type size_{0};
@@ -499,13 +769,58 @@ private:
     SYSTEM_INFO si;
     GetSystemInfo(&si);
     return si.dwPageSize;    
+#else
+    return static_cast<size_type>(sysconf(_SC_PAGESIZE));
 #endif 
   }
   
   
-  static char* reserve_pages(size_type capacity) noexcept {
+  static size_type granule_size(enum pages pages) noexcept {
+    return pages == uformat::pages::huge ? huge_page_size : get_page_size();
+  }
+  
+  
+  size_type granule_size() const noexcept {
+    return granule_size(pages_);
+  }
+  
+  
+  static size_type reservation_size(enum pages pages) noexcept {
+    auto const page_size = granule_size(pages);
+    auto pages_count = MCAP / page_size;
+    if(MCAP % page_size != 0 || pages_count == 0)
+      ++pages_count;
+    return nearest_power_of_2(pages_count * page_size);
+  }
+  
+  
+  static char* reserve_pages(size_type capacity, enum pages pages) noexcept {
 #if defined(_WIN32)
+    // large pages can't be committed incrementally, so huge mode only
+    // coarsens commit granularity here
+    (void)pages;
     return static_cast<char*>(VirtualAlloc(nullptr, capacity, MEM_RESERVE, PAGE_NOACCESS));
+#else
+    // address space only: no backing store is accounted until pages are committed
+    size_type const padding = pages == uformat::pages::huge ? huge_page_size : 0;
+    void* reserved = mmap(nullptr, capacity + padding, PROT_NONE,
+                          MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if(reserved == MAP_FAILED)
+      return nullptr;
+    char* const begin = static_cast<char*>(reserved);
+    if(padding == 0)
+      return begin;
+    // trim the padding so the region starts on a huge page boundary
+    auto const misalignment = reinterpret_cast<std::uintptr_t>(begin) % huge_page_size;
+    size_type const head = misalignment == 0 ? 0 : huge_page_size - misalignment;
+    if(head != 0)
+      munmap(begin, head);
+    munmap(begin + head + capacity, padding - head);
+#if defined(MADV_HUGEPAGE)
+    // advisory only: falls back to regular pages if THP is disabled
+    madvise(begin + head, capacity, MADV_HUGEPAGE);
+#endif
+    return begin + head;
 #endif
   }
   
@@ -513,13 +828,32 @@ private:
   static char* commit_pages(char* address, size_type size) noexcept {
 #if defined(_WIN32)
   return static_cast<char*>(VirtualAlloc(address, size, MEM_COMMIT, PAGE_READWRITE));
+#else
+    // like VirtualAlloc, round the range out to whole pages
+    auto const page_size = get_page_size();
+    auto const offset = reinterpret_cast<std::uintptr_t>(address) % page_size;
+    if(mprotect(address - offset, size + offset, PROT_READ | PROT_WRITE) != 0)
+      return nullptr;
+    return address;
 #endif    
   }
   
   
+  static void decommit_pages(char* address, size_type size) noexcept {
+#if defined(_WIN32)
+    VirtualFree(address, size, MEM_DECOMMIT);
+#else
+    madvise(address, size, MADV_DONTNEED);
+    mprotect(address, size, PROT_NONE);
+#endif
+  }
+  
+  
   static void release_pages(char* address, size_type size) noexcept {
 #if defined(_WIN32)
-    VirtualFree(address, size, MEM_RELEASE);
+    VirtualFree(address, 0, MEM_RELEASE);
+#else
+    munmap(address, size);
 #endif    
   }
   
@@ -527,7 +861,25 @@ private:
   void dispose() noexcept {
     if(data_ == nullptr)
       return;
-    release_pages(data_, reserved_capacity_);
+#if defined(__linux__)
+    if(fd_ != -1) {
+      release_pages(data_, reserved_capacity_);
+      close(fd_);
+      fd_ = -1;
+      data_ = nullptr;
+      reserved_capacity_ = 0;
+      committed_capacity_ = 0;
+      size_ = 0;
+      return;
+    }
+#endif
+    auto& pool = continuous_string::pool(pages_);
+    if(committed_capacity_ > pool.retained_bytes()) {
+      size_ = 0;
+      shrink_to_fit();
+    }
+    if(!pool.recycle(data_, committed_capacity_))
+      release_pages(data_, reserved_capacity_);
     data_ = nullptr;
     reserved_capacity_ = 0;
     committed_capacity_ = 0;
@@ -536,17 +888,29 @@ private:
   
   
   bool reserve() noexcept {
-    auto const page_size = get_page_size();
-    auto pages_count = MCAP / page_size;
-    if(MCAP % page_size != 0 || pages_count == 0)
-      ++pages_count;
-    auto const reserved_capacity = nearest_power_of_2(pages_count * page_size);     
-    auto const reserved = reserve_pages(reserved_capacity);
+    auto const page_size = granule_size();
+    auto const reserved_capacity = reservation_size(pages_);
+#if defined(__linux__)
+    if(pages_ == uformat::pages::memfd)
+      return reserve_file(reserved_capacity, page_size);
+#endif
+    size_type recycled_capacity;
+    if(char* recycled = pool(pages_).acquire(recycled_capacity)) {
+      reserved_capacity_ = reserved_capacity;
+      committed_capacity_ = recycled_capacity;
+      data_ = recycled;
+      data_[0] = '\0';
+      return true;
+    }
+    auto const reserved = reserve_pages(reserved_capacity, pages_);
     if(reserved == nullptr)
       return false;
     auto const committed = commit_pages(reserved, page_size);
-    if(committed == nullptr)
+    if(committed == nullptr) {
+      release_pages(reserved, reserved_capacity);
       return false;
+    }
+    ++commits_;
     reserved_capacity_ = reserved_capacity;
     committed_capacity_ = page_size;
     data_ = committed;
@@ -555,6 +919,39 @@ private:
   }
   
   
+#if defined(__linux__)
+  bool reserve_file(size_type reserved_capacity, size_type page_size) noexcept {
+    int const fd = memfd_create("uformat", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if(fd == -1)
+      return false;
+    if(ftruncate(fd, static_cast<off_t>(page_size)) != 0) {
+      close(fd);
+      return false;
+    }
+    char* const mapped = map_file(fd, reserved_capacity);
+    if(mapped == nullptr) {
+      close(fd);
+      return false;
+    }
+    ++commits_;
+    fd_ = fd;
+    reserved_capacity_ = reserved_capacity;
+    committed_capacity_ = page_size;
+    data_ = mapped;
+    data_[0] = '\0';
+    return true;
+  }
+  
+  
+  // mapped once over the whole reservation, pages past the file end are backed on growth
+  static char* map_file(int fd, size_type reserved_capacity) noexcept {
+    void* mapped = mmap(nullptr, reserved_capacity, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_NORESERVE, fd, 0);
+    return mapped != MAP_FAILED ? static_cast<char*>(mapped) : nullptr;
+  }
+#endif
+  
+  
   bool commit(size_type new_capacity) noexcept {
     
     if(new_capacity <= committed_capacity_)
@@ -567,12 +964,24 @@ private:
     if(new_capacity > reserved_capacity_)
       return false;
     
-    auto committed = commit_pages(&data_[size_], new_capacity - committed_capacity_);
-    if(committed == nullptr)
+    return grow(new_capacity);
+  }
+  
+  
+  bool grow(size_type new_capacity) noexcept {
+#if defined(__linux__)
+    if(fd_ != -1) {
+      // the whole reservation is mapped, growing the file backs more of it
+      if(ftruncate(fd_, static_cast<off_t>(new_capacity)) != 0)
+        return false;
+    } else
+#endif
+    if(commit_pages(&data_[committed_capacity_], new_capacity - committed_capacity_) == nullptr)
       return false;
     
+    ++commits_;
     committed_capacity_ = new_capacity;
-    return true;   
+    return true;
   }
 
 };
@@ -0,0 +1,308 @@
+#pragma once
+
+
+#include <cstddef>
+#include <cstring>
+#include <new>
+#include <string>
+#include <string_view>
+#include <stdexcept>
+
+
+namespace uformat {
+
+
+  // Keeps up to N characters inline and moves to the heap beyond that,
+  // so unlike fixed_string it never truncates while short contents cost
+  // no allocation. If the heap is exhausted it stops growing the way
+  // fixed_string does.
+  template<std::size_t N>
+  class small_string {
+  public:
+
+    using value_type = char;
+    using size_type = std::size_t;
+    using difference_type = std::ptrdiff_t;
+    using pointer = char*;
+    using const_pointer = char const*;
+    using reference = char&;
+    using const_reference = char const&;
+    using iterator = char*;
+    using const_iterator = char const*;
+
+    static constexpr size_type npos = size_type(-1);
+
+    small_string() noexcept {
+      buffer_[0] = '\0';
+    }
+
+    ~small_string() {
+      if(spilled())
+        delete[] p_;
+    }
+
+    small_string(small_string const& rhs) noexcept {
+      buffer_[0] = '\0';
+      assign(rhs.data(), rhs.data() + rhs.size());
+    }
+
+    small_string(small_string&& rhs) noexcept {
+      buffer_[0] = '\0';
+      take(rhs);
+    }
+
+    explicit small_string(char const* data) noexcept {
+      buffer_[0] = '\0';
+      assign(data);
+    }
+
+    small_string(char const* b, char const* e) noexcept {
+      buffer_[0] = '\0';
+      assign(b, e);
+    }
+
+    explicit small_string(std::string const& rhs) noexcept {
+      buffer_[0] = '\0';
+      assign(rhs.data(), rhs.data() + rhs.size());
+    }
+
+    explicit small_string(std::string_view const& rhs) noexcept {
+      buffer_[0] = '\0';
+      assign(rhs.data(), rhs.data() + rhs.size());
+    }
+
+    small_string& operator = (small_string const& rhs) noexcept {
+      if(this == &rhs)
+        return *this;
+      return assign(rhs.data(), rhs.data() + rhs.size());
+    }
+
+    small_string& operator = (small_string&& rhs) noexcept {
+      if(this == &rhs)
+        return *this;
+      if(spilled())
+        delete[] p_;
+      p_ = buffer_; n_ = 0; capacity_ = N;
+      take(rhs);
+      return *this;
+    }
+
+    small_string& operator = (char const* data) noexcept {
+      return assign(data);
+    }
+
+    small_string& operator = (std::string const& rhs) noexcept {
+      return assign(rhs.data(), rhs.data() + rhs.size());
+    }
+
+    small_string& operator = (std::string_view const& rhs) noexcept {
+      return assign(rhs.data(), rhs.data() + rhs.size());
+    }
+
+    char* begin() noexcept { return p_; }
+    char* end() noexcept { return p_ + n_; }
+    char const* begin() const noexcept { return p_; }
+    char const* end() const noexcept { return p_ + n_; }
+    char const* cbegin() const noexcept { return p_; }
+    char const* cend() const noexcept { return p_ + n_; }
+
+    size_type size() const noexcept { return n_; }
+    size_type length() const noexcept { return n_; }
+    size_type max_size() const noexcept { return npos - 1; }
+    size_type capacity() const noexcept { return capacity_; }
+    bool empty() const noexcept { return n_ == 0; }
+    bool spilled() const noexcept { return p_ != buffer_; }
+    void clear() noexcept { n_ = 0; p_[0] = '\0'; }
+
+    void reserve(size_type n) noexcept {
+      grow(n);
+    }
+
+    void resize(size_type n) noexcept {
+      if(!grow(n))
+        return;
+      n_ = n; p_[n] = '\0';
+    }
+
+    void shrink_to_fit() noexcept {
+      if(!spilled() || n_ > N)
+        return;
+      std::memcpy(buffer_, p_, n_ + 1);
+      delete[] p_;
+      p_ = buffer_;
+      capacity_ = N;
+    }
+
+    char& operator [] (size_type i) noexcept {
+      return p_[i];
+    }
+
+    char const& operator [] (size_type i) const noexcept {
+      return p_[i];
+    }
+
+    char& at (size_type i) {
+      if(i >= n_)
+        throw std::out_of_range("invalid string position");
+      return p_[i];
+    }
+
+    char const& at (size_type i) const {
+      if(i >= n_)
+        throw std::out_of_range("invalid string position");
+      return p_[i];
+    }
+
+    char& back() noexcept { return p_[n_ - 1]; }
+    char const& back() const noexcept { return p_[n_ - 1]; }
+    char& front() noexcept { return p_[0]; }
+    char const& front() const noexcept { return p_[0]; }
+
+    small_string& operator += (char c) noexcept {
+      push_back(c);
+      return *this;
+    }
+
+    small_string& operator += (char const* cc) noexcept {
+      return append(cc);
+    }
+
+    small_string& operator += (std::string const& rhs) noexcept {
+      return append(rhs.data(), rhs.data() + rhs.size());
+    }
+
+    small_string& operator += (std::string_view const& rhs) noexcept {
+      return append(rhs.data(), rhs.data() + rhs.size());
+    }
+
+    small_string& append(std::string const& rhs) noexcept {
+      return append(rhs.data(), rhs.data() + rhs.size());
+    }
+
+    small_string& append(std::string_view const& rhs) noexcept {
+      return append(rhs.data(), rhs.data() + rhs.size());
+    }
+
+    small_string& append(char const* cc, size_type n) noexcept {
+      return append(cc, cc + n);
+    }
+
+    small_string& append(char const* cc) noexcept {
+      if(!cc)
+        return *this;
+      return append(cc, cc + std::strlen(cc));
+    }
+
+    small_string& append(char const* b, char const* e) noexcept {
+      if(!b || !e || b == e)
+        return *this;
+      size_type const m = static_cast<size_type>(e - b);
+      if(!grow(n_ + m))
+        return *this;
+      std::memcpy(p_ + n_, b, m);
+      n_ += m;
+      p_[n_] = '\0';
+      return *this;
+    }
+
+    void push_back(char c) noexcept {
+      if(n_ == capacity_ && !grow(n_ + 1))
+        return;
+      p_[n_++] = c; p_[n_] = '\0';
+    }
+
+    void pop_back() noexcept {
+      if(n_ == 0) return;
+      p_[--n_] = '\0';
+    }
+
+    small_string& assign(std::string const& rhs) noexcept {
+      return assign(rhs.data(), rhs.data() + rhs.size());
+    }
+
+    small_string& assign(std::string_view const& rhs) noexcept {
+      return assign(rhs.data(), rhs.data() + rhs.size());
+    }
+
+    small_string& assign(char const* data) noexcept {
+      n_ = 0; p_[0] = '\0';
+      return append(data);
+    }
+
+    small_string& assign(char const* b, char const* e) noexcept {
+      n_ = 0; p_[0] = '\0';
+      return append(b, e);
+    }
+
+    char const* c_str() const noexcept { return p_; }
+    char const* data() const noexcept { return p_; }
+
+    std::string_view substr(size_type pos, size_type n) const noexcept {
+      return std::string_view{p_ + pos, n};
+    }
+
+    int compare(std::string_view const& rhs) const noexcept {
+      return std::string_view{p_, n_}.compare(rhs);
+    }
+
+  private:
+
+    char* p_{buffer_};
+    size_type n_{0};
+    size_type capacity_{N};
+    char buffer_[N + 1];
+
+
+    bool grow(size_type n) noexcept {
+      if(n <= capacity_)
+        return true;
+      size_type capacity = capacity_ * 2;
+      if(capacity < n)
+        capacity = n;
+      char* const p = new (std::nothrow) char[capacity + 1];
+      if(p == nullptr)
+        return false;
+      std::memcpy(p, p_, n_ + 1);
+      if(spilled())
+        delete[] p_;
+      p_ = p;
+      capacity_ = capacity;
+      return true;
+    }
+
+
+    void take(small_string& rhs) noexcept {
+      if(rhs.spilled()) {
+        p_ = rhs.p_; n_ = rhs.n_; capacity_ = rhs.capacity_;
+        rhs.p_ = rhs.buffer_; rhs.n_ = 0; rhs.capacity_ = N;
+        rhs.buffer_[0] = '\0';
+        return;
+      }
+      assign(rhs.data(), rhs.data() + rhs.size());
+      rhs.clear();
+    }
+
+  }; // small_string
+
+
+
+  template<std::size_t N>
+  bool operator == (small_string<N> const& x, std::string_view const& y) {
+    return x.compare(y) == 0;
+  }
+
+
+  template<std::size_t N>
+  bool operator != (small_string<N> const& x, std::string_view const& y) {
+    return x.compare(y) != 0;
+  }
+
+
+  template<typename OS, std::size_t N>
+  OS& operator << (OS& stream, small_string<N> const& ss) {
+    stream << std::string_view{ ss.data(), ss.size() };
+    return stream;
+  }
+
+
+} // uformat
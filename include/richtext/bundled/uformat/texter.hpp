@@ -29,7 +29,9 @@
 #include <cmath>
 #include <mutex>
 #include <cstdio>
+#include <cstring>
 #include "fixed_string.hpp"
+#include "small_string.hpp"
 #include "continuous_string.hpp"
 
 
@@ -56,12 +58,16 @@ namespace uformat {
     texter& operator = (texter const&) = default;
     texter(texter&&) noexcept = default;
     texter& operator = (texter&&) noexcept = default;
+    explicit texter(S string) noexcept: string_{std::move(string)} { }
 
     S const& string() const noexcept { return string_; }
+    S& string() noexcept { return string_; }
     char const* data() const noexcept { return string_.data(); }
     size_type size() const noexcept { return string_.size(); }
     bool empty() const noexcept { return string_.empty(); }
     void clear() noexcept { string_.clear(); }
+    void shrink_to_fit() { string_.shrink_to_fit(); }
+    void shrink_to(size_type capacity) { string_.shrink_to(capacity); }
 
 
     size_type capacity() const noexcept {
@@ -90,14 +96,29 @@ namespace uformat {
     }
 
 
+    // Write window: prepare() makes room for up to n characters and returns
+    // where to write them (nullptr if the string can't grow that much),
+    // commit() takes the end of what was actually written.
+    char* prepare(size_type n) {
+      size_type const old_size = string_.size();
+      string_.resize(old_size + n);
+      if(string_.size() != old_size + n)
+        return nullptr;
+      return &string_[old_size];
+    }
+
+
+    texter& commit(char const* end) {
+      string_.resize(size_type(end - string_.data()));
+      return *this;
+    }
+
+
     texter& char_n(char c, size_type n) {
-      size_type allocated;
-      char* buffer = allocate(n, allocated);
+      char* const buffer = prepare(n);
       if (!buffer) return *this;
-      char* p = buffer;
-      for (char* p = buffer; p != buffer + n; ++p)
-        *p = c;
-      return shrink(allocated - n);
+      std::memset(buffer, c, n);
+      return commit(buffer + n);
     }
 
 
@@ -186,17 +207,40 @@ namespace uformat {
 
 
     texter& fixed(uint64_t x, unsigned width) {
-      constexpr auto digits = 18;
+      constexpr auto digits = 20;
       return print_fixed_int<digits>(x, width);
     }
 
 
     texter& fixed(int64_t x, unsigned width) {
-      constexpr auto digits = 19;
+      constexpr auto digits = 20;
       return print_fixed_int<digits>(x, width);
     }
 
 
+    // Write what operator << and fixed() would at p and return the end,
+    // so callers can measure a number without a texter of their own.
+    // p needs max_number_size characters.
+    static constexpr size_type max_number_size = 40;
+
+    static char* format(int64_t x, char* p) noexcept {
+      convert(x, p);
+      return p;
+    }
+
+
+    static char* format(uint64_t x, char* p) noexcept {
+      convert(x, p);
+      return p;
+    }
+
+
+    static char* format(double x, unsigned precision, char* p) noexcept {
+      convert(x, p, precision);
+      return p;
+    }
+
+
     template<typename T> texter& quoted(T&& arg) {
       string_.push_back('\'');
       (*this) << arg;
@@ -286,13 +330,13 @@ namespace uformat {
 
 
     friend texter& operator << (texter& p, uint64_t x) {
-      constexpr auto digits = 18;
+      constexpr auto digits = 20;
       return p.print_int<digits>(x);
     }
 
 
     friend texter& operator << (texter& p, int64_t x) {
-      constexpr auto digits = 19;
+      constexpr auto digits = 20;
       return p.print_int<digits>(x);
     }
 
@@ -414,75 +458,36 @@ namespace uformat {
     }
 
 
-    char* allocate(size_type n, size_type& m) {
-
-      size_type const old_size = string_.size();
-      size_type new_size = old_size + n;
-
-      if(new_size > string_.capacity()) {
-        new_size = nearest_power_of_2(new_size);
-        m = size_type(new_size - old_size);
-      }
-      else {
-        m = n;
-      }
-
-      string_.resize(new_size);
-
-      if(string_.size() != new_size)
-        return nullptr;
-      else
-        return &string_[old_size];
-    }
-
-
-    texter& shrink(size_type n) {
-      string_.resize(string_.size() - n);
-      return *this;
-    }
-
-
     template<unsigned N, typename T> texter& print_int(T x) {
-      size_type digits;
-      char* buffer = allocate(N, digits);
-      if(!buffer) return *this;
-      char* p = buffer;
+      char* p = prepare(N);
+      if(!p) return *this;
       convert(x, p);
-      shrink(digits - (p - buffer));
-      return *this;
+      return commit(p);
     }
 
 
     template<unsigned N, typename T> texter& print_fixed_int(T x, unsigned width) {
       if(width > N)
         width = N;
-      size_type digits;
-      char* buffer = allocate(width, digits);
+      char* buffer = prepare(N);
       if(!buffer) return *this;
       char* p = buffer;
       convert(x, p);
       unsigned const actual_width = unsigned(p - buffer);
       if(actual_width >= width)
-        return shrink(digits - actual_width);
+        return commit(p);
       unsigned const leadings_count = width - actual_width;
-      for(p = buffer + actual_width - 1; p != buffer + leadings_count - 1; --p)
-        p[leadings_count] = p[0];
-      for(; p != buffer - 1; --p) {
-        p[leadings_count] = p[0];
-        p[0] = '0';
-      }
-      shrink(digits - width);
-      return *this;
+      std::memmove(buffer + leadings_count, buffer, actual_width);
+      std::memset(buffer, '0', leadings_count);
+      return commit(buffer + width);
     }
 
 
     template<typename T> texter& print_fixed_float(T x, unsigned precision) {
-      size_type digits;
-      char* buffer = allocate(38, digits);
-      if(!buffer) return *this;
-      char* p = buffer;
+      char* p = prepare(max_number_size);
+      if(!p) return *this;
       convert(double(x), p, precision);
-      return shrink(digits - (p - buffer));
+      return commit(p);
     }
 
 
@@ -505,14 +510,28 @@ namespace uformat {
         *p++ = '-';
         x = -x;
       }
-      
+      // past uint64_t, digits below the exponent mean nothing anyway
+      if(x >= 18446744073709551615.0) {
+        p += std::snprintf(p, max_number_size - 1, "%.*e", int(precision), x);
+        return;
+      }
+
       uint64_t integer = uint64_t(x);
+      uint64_t const scale = uint64_t(pow10[precision]);
+      uint64_t fraction = uint64_t((x - double(integer)) * pow10[precision] + 0.5);
+      if(fraction >= scale) {
+        fraction -= scale;
+        ++integer;
+      }
       convert(integer, p);
+      if(precision == 0)
+        return;
       *p++ = '.';
-      x -= double(integer);
-      x *= pow10[precision];
-      x += 0.5;
-      convert(uint64_t(x), p);
+      for(unsigned i = precision; i != 0; --i) {
+        p[i - 1] = char('0' + fraction % 10);
+        fraction /= 10;
+      }
+      p += precision;
     }
 
 
@@ -532,7 +551,8 @@ namespace uformat {
     static void convert(int32_t x, char*& p) {
       if(x < 0) {
         *p++ = '-';
-        x = -x;
+        convert(uint32_t(0) - uint32_t(x), p);
+        return;
       }
       convert(uint32_t(x), p);
     }
@@ -557,7 +577,8 @@ namespace uformat {
     static void convert(int64_t x, char*& p) {
       if(x < 0) {
         *p++ = '-';
-        x = -x;
+        convert(uint64_t(0) - uint64_t(x), p);
+        return;
       }
       convert(uint64_t(x), p);
     }
@@ -637,6 +658,7 @@ namespace uformat {
   using dpage_texter = texter<dpage_string>;
   using large_texter = texter<large_string>;
   using continuous_texter = texter<continuous_string<>>;
+  using small_texter = texter<small_string<256>>;
 
 
   namespace detail::printer {
@@ -3,6 +3,8 @@
 
 #include <string>
 #include <cstdio>
+#include <cstring>
+#include <algorithm>
 #include <vector>
 #include <stack>
 #include "../richtext.hpp"
@@ -11,92 +13,103 @@
 namespace richtext::formatters {
 
 
-class markdown: public formatter {
+class markdown_options {
 public:
 
-  using column_width_array = std::vector<formatter::size_type>;
+  std::size_t static constexpr default_margin = 80;
+  std::size_t static constexpr default_indent = 4;
 
+  markdown_options() noexcept = default;
+  markdown_options(markdown_options const&) noexcept = default;
+  markdown_options& operator = (markdown_options const&) noexcept = default;
 
-  class options {
-  public:
+  markdown_options& margin(std::size_t margin) noexcept { margin_ = margin; return *this; }
+  markdown_options& indent(std::size_t indent) noexcept { indent_ = indent; return *this; }
+  markdown_options& pages(uformat::pages pages) noexcept { pages_ = pages; return *this; }
 
-    std::size_t static constexpr default_margin = 80;
-    std::size_t static constexpr default_indent = 4;
+  std::size_t magin() const noexcept { return margin_; }
+  std::size_t indent() const noexcept { return indent_; }
+  uformat::pages pages() const noexcept { return pages_; }
 
-    options() noexcept = default;
-    options(options const&) noexcept = default;
-    options& operator = (options const&) noexcept = default;
+private:
+
+  std::size_t margin_{ default_margin };
+  std::size_t indent_{ default_indent };
+  uformat::pages pages_{ uformat::pages::regular };
+};
 
-    options& margin(std::size_t margin) noexcept { margin_ = margin; }
-    options& indent(std::size_t indent) noexcept { indent_ = indent; }
 
-    std::size_t magin() const noexcept { return margin_; }
-    std::size_t indent() const noexcept { return indent_; }
+// Base is formatter for the virtual hooks or basic_formatter<Derived> for
+// static dispatch, see markdown and static_markdown below. Indentation and
+// open tables are undone by the end of each node, so a node renders to the
+// same bytes wherever it lands.
+template<typename Base>
+class basic_markdown: public Base {
+public:
 
-  private:
+  using typename Base::size_type;
+  using typename Base::column_widths;
+  using column_width_array = column_widths;
+  using options = markdown_options;
 
-    std::size_t margin_{ default_margin };
-    std::size_t indent_{ default_indent };
-  };
+  basic_markdown() = default;
+  basic_markdown(basic_markdown const&) = delete;
+  basic_markdown& operator = (basic_markdown const&) = delete;
 
-  markdown() = default;
-  markdown(markdown const&) = delete;
-  markdown& operator = (markdown const&) = delete;
 
+  explicit basic_markdown(options const& options) noexcept:
+    Base{ options.pages() }, options_{ options } { }
 
-  explicit markdown(options const& options) noexcept: options_{ options } { }
+  // formatter also has the std::string const& header hooks, kept visible
+  using Base::on_document_header;
+  using Base::on_section_header;
+  using Base::on_subsection_header;
+  using Base::on_table_header_cell;
+  using Base::on_unordered_list_header;
+  using Base::on_ordered_list_header;
 
-  void on_document_header(std::string const& header) noexcept override {
+  void on_document_header(std::string_view header) noexcept {
     texter() << '\n' << '#' << ' ' << header << '\n' << '\n';
   }
 
-  void on_section_header(std::string const& header) noexcept override {
+  void on_section_header(std::string_view header) noexcept {
     texter() << '\n' << '#' << '#' << ' ' << header << '\n' << '\n';
   }
 
-  void on_subsection_header(std::string const& header) noexcept override {
+  void on_subsection_header(std::string_view header) noexcept {
     texter() << '\n' << '#' << '#' << '#' << ' ' << header << '\n' << '\n';
   }
 
 
-  void on_text(text const& text) override {
+  void on_text(text const& text) {
     for (auto const& span : text)
       do_span(texter(), span);
   }
 
 
-  void on_paragraph_end(paragraph const&) override {
+  void on_paragraph_end(paragraph const&) {
     texter() << '\n' << '\n';
   }
 
 
-  void on_table_begin(table const& table) override {
-    column_width_array columns;
-    columns.resize(table.columns_count());
-    for (size_type i = 0; i != table.columns_count(); ++i) {
-      columns[i] = table.header()[i].size();
-      for (auto const& row : table) {
-        if (row.at(i).length() > columns[i])
-          columns[i] = row.at(i).length();
-      }
-    }
-    table_stack_.emplace(std::move(columns));
+  void on_table_columns(column_widths const& columns) {
+    table_stack_.push(columns);
   }
 
 
-  void on_table_end(table const&) override {
+  void on_table_end(table const&) {
     table_stack_.pop();
     texter() << '\n';
   }
 
 
-  void on_table_header_begin(table_header const&) override {
+  void on_table_header_begin(table_header const&) {
     indent();
     texter() << '|';
   }
 
 
-  void on_table_header_end(table_header const& header) override {
+  void on_table_header_end(table_header const& header) {
     texter() << '\n';
     indent();
     texter() << '|';
@@ -110,7 +123,7 @@ public:
   }
 
 
-  void on_table_header_cell(std::size_t i, std::string const& text) override {
+  void on_table_header_cell(std::size_t i, std::string_view text) {
     column_width_array const& columns = table_stack_.top();
     texter() << ' ';
     if (i == 0)
@@ -121,23 +134,23 @@ public:
   }
 
 
-  void on_table_row_begin(table_row const&) override {
+  void on_table_row_begin(table_row const&) {
     indent();
     texter() << '|';
   }
 
 
-  void on_table_row_end(table_row const&) override {
+  void on_table_row_end(table_row const&) {
     texter() << '\n';
   }
 
 
-  void on_table_cell_end(std::size_t, span const&) override {
+  void on_table_cell_end(std::size_t, span const&) {
     texter() << ' ' << '|';
   }
 
 
-  void on_table_cell_text(std::size_t i, span const& span) override {
+  void on_table_cell_text(std::size_t i, span const& span) {
     texter() << ' ';
     column_width_array const& columns = table_stack_.top();
     if (i == 0)
@@ -147,48 +160,48 @@ public:
   }
 
 
-  void on_unordered_list_end(unordered_list const&) override {
+  void on_unordered_list_end(unordered_list const&) {
     texter() << '\n';
   }
 
 
-  void on_unordered_list_header(std::string const& header) override {
+  void on_unordered_list_header(std::string_view header) {
     indent();
     texter() << header << '\n';
   }
 
 
-  void on_unordered_list_item_begin(fragment const&) override {
+  void on_unordered_list_item_begin(list_item const&) {
     indent();
     texter() << '-' << ' ';
     indent_ += options_.indent();
   }
 
 
-  void on_unordered_list_item_end(fragment const&) override {
+  void on_unordered_list_item_end(list_item const&) {
     indent_ -= options_.indent();
     texter() << '\n';
   }
 
 
-  void on_ordered_list_end(ordered_list const&) override {
+  void on_ordered_list_end(ordered_list const&) {
     texter() << '\n';
   }
 
 
-  void on_ordered_list_header(std::string const& header) override {
+  void on_ordered_list_header(std::string_view header) {
     indent();
     texter() << header << '\n';
   }
 
-  void on_ordered_list_item_begin(std::size_t i, fragment const&) override {
+  void on_ordered_list_item_begin(std::size_t i, list_item const&) {
     indent();
     texter() << i << '.' << ' ';
     indent_ += options_.indent();
   }
 
 
-  void on_ordered_list_item_end(std::size_t, fragment const&) override {
+  void on_ordered_list_item_end(std::size_t, list_item const&) {
     indent_ -= options_.indent();
     texter() << '\n';
   }
@@ -196,6 +209,7 @@ public:
 
 private:
   using table_stack = std::stack<column_width_array>;
+  using Base::texter;
 
   std::size_t indent_{ 0 };
   options options_;
@@ -210,14 +224,56 @@ private:
 
 
   void left_span(size_type width, span const& span) {
-    uformat::long_texter t; do_span(t, span);
-    texter().left(width, t);
+    // rendered in place, only the padding follows
+    size_type const previous_size = texter().size();
+    do_span(texter(), span);
+    size_type const n = texter().size() - previous_size;
+    if (n < width)
+      texter().char_n(' ', width - n);
   }
 
 
   void right_span(size_type width, span const& span) {
-    uformat::long_texter t; do_span(t, span);
-    texter().right(width, t);
+    if (span.kind() != value_kind::text) {
+      // width is known up front, digits go straight to the output
+      size_type const n = span.length() + 2 * markers(span.tag());
+      if (n < width)
+        texter().char_n(' ', width - n);
+      do_span(texter(), span);
+      return;
+    }
+    // escaped in place with room for the padding, then moved right past it
+    std::string_view const text = span.text();
+    size_type const marks = markers(span.tag());
+    size_type const most = text.size() * 2 + 2 * marks;
+    char* const begin = texter().prepare(std::max(width, most));
+    if (begin == nullptr) {
+      uformat::small_texter t; do_span(t, span);
+      if (t.size() < width)
+        texter().char_n(' ', width - t.size());
+      texter() << t;
+      return;
+    }
+    char* p = std::fill_n(begin, marks, '*');
+    p = escape(p, text);
+    p = std::fill_n(p, marks, '*');
+    size_type const n = size_type(p - begin);
+    if (n < width) {
+      std::memmove(begin + (width - n), begin, n);
+      std::memset(begin, ' ', width - n);
+      p = begin + width;
+    }
+    texter().commit(p);
+  }
+
+
+  static size_type markers(tag tag) noexcept {
+    switch (tag) {
+    case tag::strong: return 2;
+    case tag::emphasis: return 1;
+    case tag::strong_emphasis: return 3;
+    default: return 0;
+    }
   }
 
 
@@ -226,43 +282,87 @@ private:
     switch (span.tag()) {
     case tag::strong:
       texter << '*' << '*';
-      escape(texter, span.text());
+      content(texter, span);
       texter << '*' << '*';
       return;
     case tag::emphasis:
       texter << '*';
-      escape(texter, span.text());
+      content(texter, span);
       texter << '*';
       return;
     case tag::strong_emphasis:
       texter << '*' << '*' << '*';
-      escape(texter, span.text());
+      content(texter, span);
       texter << '*' << '*' << '*';
       return;
     default:
-      escape(texter, span.text());
+      content(texter, span);
       return;
     }
   }
 
 
   template<typename S>
-  void escape(uformat::texter<S>& texter, std::string const& string) {
-    for(auto const c: string)
-      switch (c) {
-      case '\\': case '`': case '*': case '_':
-      case '{': case '}': case '[': case ']':
-      case '#': case '|':
-        texter << '\\' << c;
-        continue;
-      default:
+  void content(uformat::texter<S>& texter, span const& span) {
+    if (span.kind() == value_kind::text)
+      escape(texter, span.text());
+    else
+      span.print(texter);
+  }
+
+
+  static bool escaped(char c) noexcept {
+    switch (c) {
+    case '\\': case '`': case '*': case '_':
+    case '{': case '}': case '[': case ']':
+    case '#': case '|':
+      return true;
+    default:
+      return false;
+    }
+  }
+
+
+  template<typename S>
+  void escape(uformat::texter<S>& texter, std::string_view string) {
+    // every character escaped is the worst case
+    char* p = texter.prepare(string.size() * 2);
+    if (p == nullptr) {
+      for (auto const c : string) {
+        if (escaped(c))
+          texter << '\\';
         texter << c;
-        continue;
       }
+      return;
+    }
+    texter.commit(escape(p, string));
+  }
+
+
+  // p has room for twice the string, returns the end of what's written
+  static char* escape(char* p, std::string_view string) noexcept {
+    for (auto const c : string) {
+      if (escaped(c))
+        *p++ = '\\';
+      *p++ = c;
+    }
+    return p;
   }
 
 };
 
 
+class markdown: public basic_markdown<formatter> {
+public:
+  using basic_markdown::basic_markdown;
+};
+
+
+// markdown without virtual calls, for documents rendered with render()
+class static_markdown final: public basic_markdown<basic_formatter<static_markdown>> {
+public:
+  using basic_markdown::basic_markdown;
+};
+
 
 }
@@ -2,10 +2,32 @@
 
 
 #include <string>
-#include <list>
+#include <string_view>
+#include <vector>
 #include <variant>
 #include <memory>
+#include <functional>
+#include <unordered_map>
+#include <list>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <exception>
+#include <memory_resource>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <charconv>
+#include <cmath>
+#include <algorithm>
+#include <iterator>
+#include <initializer_list>
+#include <new>
+#include <type_traits>
+#include <limits>
 #include <system_error>
+#include <stdexcept>
 
 #if defined(RICHTEXT_USE_SYSTEM_UFORMAT)
 #include <uformat/texter.hpp>
@@ -17,103 +39,710 @@
 namespace richtext {
 
 
+namespace pmr {
+
+  using allocator_type = std::pmr::polymorphic_allocator<char>;
+  using string = std::pmr::string;
+
+
+  // resource used by model objects created without an allocator
+  inline std::pmr::memory_resource* resource() noexcept {
+    return std::pmr::get_default_resource();
+  }
+
+
+  inline allocator_type allocator() noexcept {
+    return allocator_type{ resource() };
+  }
+
+
+  // Monotonic arena for a document: objects built with its allocator take
+  // their memory from it, nothing is freed piecemeal and the whole
+  // document's memory goes away at once with the arena. Children added to
+  // a document move into the document's allocator, so passing it to the
+  // document is enough, passing it to the children as well spares copying
+  // them. An arena created with a capacity keeps that block across reset(),
+  // so a worker rendering one report after another reuses warm memory.
+  class arena {
+  public:
+
+    arena() = default;
+    explicit arena(std::size_t capacity):
+      buffer_{ new std::byte[capacity] },
+      resource_{ buffer_.get(), capacity } { }
+    arena(arena const&) = delete;
+    arena& operator = (arena const&) = delete;
+    std::pmr::memory_resource* resource() noexcept { return &resource_; }
+    allocator_type allocator() noexcept { return allocator_type{ &resource_ }; }
+
+    // every object allocated from the arena must be gone by now
+    void reset() noexcept { resource_.release(); }
+
+  private:
+
+    std::unique_ptr<std::byte[]> buffer_;
+    std::pmr::monotonic_buffer_resource resource_;
+  };
+
+
+  namespace detail {
+
+    // moves the alternative held by a variant into memory from the allocator
+    template<typename V>
+    V rebind(V&& item, allocator_type const& allocator) {
+      return std::visit([&](auto&& x) -> V {
+        using type = std::decay_t<decltype(x)>;
+        if constexpr (std::is_same_v<type, std::monostate>)
+          return V{};
+        else if constexpr (!std::uses_allocator_v<type, allocator_type>)
+          return V{ std::in_place_type<type>, std::move(x) };
+        else
+          return V{ std::in_place_type<type>, std::move(x), allocator };
+      }, std::move(item));
+    }
+
+  }
+
+} // pmr
+
+
 enum class tag {
   undefined, normal, strong, emphasis, strong_emphasis 
 };
 
 
+namespace detail {
+
+  constexpr std::uint64_t hash_seed = 0xcbf29ce484222325ull;
+
+  // FNV-1a, fingerprints only have to tell contents apart
+  inline std::uint64_t hash(std::uint64_t seed, void const* data, std::size_t size) noexcept {
+    auto const* p = static_cast<unsigned char const*>(data);
+    for (std::size_t i = 0; i != size; ++i)
+      seed = (seed ^ p[i]) * 0x100000001b3ull;
+    return seed;
+  }
+
+  inline std::uint64_t hash(std::uint64_t seed, std::string_view text) noexcept {
+    return hash(seed, text.data(), text.size());
+  }
+
+  inline std::uint64_t combine(std::uint64_t seed, std::uint64_t value) noexcept {
+    return hash(seed, &value, sizeof(value));
+  }
+
+  // Revisions of every node come from this one counter, so a revision is
+  // never repeated, even by a node that replaced another
+  inline std::uint64_t next_revision() noexcept {
+    static std::atomic<std::uint64_t> counter{ 0 };
+    return counter.fetch_add(1, std::memory_order_relaxed) + 1;
+  }
+
+  // only an rvalue std::string, everything else goes through string_view
+  template<typename S>
+  using if_owned_string = std::enable_if_t<std::is_same_v<S, std::string>>;
+
+
+  // ids of items come from one counter too, zero is never given out
+  inline std::uint64_t next_id() noexcept {
+    static std::atomic<std::uint64_t> counter{ 0 };
+    return counter.fetch_add(1, std::memory_order_relaxed) + 1;
+  }
+
+
+  // Ids of a container's items in the items' order. Added items get ever
+  // larger ids, so the ids stay sorted through removals and an id is
+  // found by binary search.
+  class item_ids {
+  public:
+
+    using size_type = std::size_t;
+
+    static constexpr size_type npos = std::numeric_limits<size_type>::max();
+
+    explicit item_ids(pmr::allocator_type const& allocator) noexcept: ids_{ allocator } { }
+    item_ids(item_ids&&) = default;
+    item_ids& operator = (item_ids&&) = default;
+    item_ids(item_ids&& other, pmr::allocator_type const& allocator):
+      ids_{ std::move(other.ids_), allocator } { }
+
+    std::uint64_t back() const noexcept { return ids_.back(); }
+    void push() { ids_.push_back(next_id()); }
+    void erase(size_type i) { ids_.erase(ids_.begin() + std::ptrdiff_t(i)); }
+    void clear() noexcept { ids_.clear(); }
+
+    // position of the item, npos once it's removed
+    size_type find(std::uint64_t id) const noexcept {
+      auto const it = std::lower_bound(ids_.begin(), ids_.end(), id);
+      return it != ids_.end() && *it == id ? size_type(it - ids_.begin()) : npos;
+    }
+
+  private:
+
+    std::pmr::vector<std::uint64_t> ids_;
+  };
+
+} // detail
+
+
+enum class value_kind {
+  text, integer, unsigned_integer, floating
+};
+
+
+// Short text is stored inline, longer text in a block from the span's
+// memory resource, borrowed text is only pointed at and a long std::string
+// moved in keeps its own buffer. A number is formatted once when the span
+// is made and its digits are copied to the output from then on: an integer
+// is stored as nothing but its digits, a floating point value keeps the
+// value and precision next to them, and only digits too long to fit are
+// formatted again when printed. Numbers have no text(), length() is the
+// width they print with. The tag and the kind of storage share the last
+// byte, so a span takes 24 bytes.
 class span {
 public:
 
-  using size_type = std::string::size_type;
+  using size_type = std::size_t;
+  using allocator_type = pmr::allocator_type;
 
-  span() noexcept = default;
+  static constexpr size_type inline_capacity = 22;
+
+  span() noexcept { local_[0] = '\0'; }
+  explicit span(allocator_type const&) noexcept: span{} { }
   span(span const&) = delete;
   span& operator = (span const&) = delete;
-  span(span&&) noexcept = default;
-  span& operator = (span&&) noexcept = default;
-  enum tag tag() const noexcept { return tag_; }
-  std::string const& text() const noexcept { return text_; }
-  bool empty() const noexcept { return text_.empty(); }
-  size_type length() const noexcept { return text_.size(); }
+  span(span&& other) noexcept { take(other); }
+
+  span& operator = (span&& other) noexcept {
+    if (this == &other)
+      return *this;
+    release();
+    take(other);
+    return *this;
+  }
+
+  // owned strings keep their buffer whatever the allocator
+  span(span&& other, allocator_type const& allocator) {
+    if (other.storage() != storage::heap || resource(other.external().data) == allocator.resource())
+      take(other);
+    else {
+      assign(other.tag(), other.text(), allocator.resource());
+      bits_ |= other.bits_ & slot_flag;
+    }
+  }
+
+  ~span() { release(); }
+
+  enum tag tag() const noexcept { return static_cast<enum tag>(bits_ & tag_mask); }
+  bool empty() const noexcept { return length() == 0; }
+  bool borrowed() const noexcept { return storage() == storage::borrowed; }
+  // a slot's text is its name, document_template fills in the value
+  bool slot() const noexcept { return (bits_ & slot_flag) != 0; }
+
+  std::string_view text() const noexcept {
+    switch (storage()) {
+      case storage::local:
+        return std::string_view{ local_, local_size_ };
+      case storage::heap:
+      case storage::borrowed: {
+        auto const e = external();
+        return std::string_view{ e.data, e.size };
+      }
+      case storage::owned:
+        return *owned();
+      default:
+        return std::string_view{};
+    }
+  }
+
+  size_type length() const noexcept {
+    switch (storage()) {
+      case storage::local:
+      case storage::integer:
+      case storage::unsigned_integer:
+        return local_size_;
+      case storage::heap:
+      case storage::borrowed:
+        return external().size;
+      case storage::owned:
+        return owned()->size();
+      default:
+        return size_type(std::uint8_t(local_[width_offset]));
+    }
+  }
+
+  enum value_kind kind() const noexcept {
+    switch (storage()) {
+      case storage::integer: return value_kind::integer;
+      case storage::unsigned_integer: return value_kind::unsigned_integer;
+      case storage::floating: return value_kind::floating;
+      default: return value_kind::text;
+    }
+  }
+
+  std::int64_t integer() const noexcept { return parse<std::int64_t>(); }
+  std::uint64_t unsigned_integer() const noexcept { return parse<std::uint64_t>(); }
+  double floating() const noexcept { return value<double>(); }
+  unsigned precision() const noexcept { return storage() == storage::floating ? local_size_ : 0; }
+
+
+  // same for spans that render the same, wherever their text is stored
+  std::uint64_t fingerprint() const noexcept {
+    std::uint8_t const marks = bits_ & (tag_mask | slot_flag);
+    auto const seed = detail::hash(detail::hash_seed, &marks, sizeof(marks));
+    if (kind() == value_kind::text)
+      return detail::hash(seed, text());
+    if (storage() != storage::floating)
+      return detail::hash(detail::hash(seed, &bits_, 1), local_, local_size_);
+    auto const number = detail::hash(detail::combine(seed, value<std::uint64_t>()), &bits_, 1);
+    return detail::hash(number, &local_size_, 1);
+  }
+
 
+  // prints a number the way formatters are expected to
+  template<typename S>
+  uformat::texter<S>& print(uformat::texter<S>& texter) const {
+    switch (storage()) {
+      case storage::integer:
+      case storage::unsigned_integer:
+        return texter.append(local_, local_size_);
+      case storage::floating:
+        if (length() > cached_digits)
+          return texter.fixed(floating(), precision());
+        return texter.append(local_ + digits_offset, length());
+      default:
+        return texter << text();
+    }
+  }
+
+
+  span(enum tag tag, std::string_view text, allocator_type const& allocator = pmr::allocator()) {
+    assign(tag, text, allocator.resource());
+  }
+
+  explicit span(std::string_view text, allocator_type const& allocator = pmr::allocator()) {
+    assign(tag::normal, text, allocator.resource());
+  }
+
+  template<typename S, typename = detail::if_owned_string<S>>
+  span(enum tag tag, S&& text, allocator_type const& allocator = pmr::allocator()) {
+    if (text.size() <= inline_capacity) {
+      assign(tag, text, allocator.resource());
+      return;
+    }
+    auto* const owned = new std::string{ std::move(text) };
+    std::memcpy(local_, &owned, sizeof(owned));
+    set(tag, storage::owned);
+  }
+
+  template<typename S, typename = detail::if_owned_string<S>>
+  explicit span(S&& text, allocator_type const& allocator = pmr::allocator()):
+    span{ tag::normal, std::move(text), allocator } { }
+
+  span(enum tag tag, std::int64_t value) noexcept {
+    set_integer(tag, storage::integer, value);
+  }
+
+  span(enum tag tag, std::uint64_t value) noexcept {
+    set_integer(tag, storage::unsigned_integer, value);
+  }
+
+  span(enum tag tag, double value, unsigned precision) noexcept {
+    if (precision > 16)
+      precision = 16;
+    std::memcpy(local_, &value, sizeof(value));
+    local_size_ = std::uint8_t(precision);
+    set(tag, storage::floating);
+    char digits[uformat::continuous_texter::max_number_size];
+    auto const width = size_type(uformat::continuous_texter::format(value, precision, digits) - digits);
+    local_[width_offset] = char(width);
+    if (width <= cached_digits)
+      std::memcpy(local_ + digits_offset, digits, width);
+  }
+
+  span(enum tag tag, std::int64_t value, allocator_type const&) noexcept: span{ tag, value } { }
+  span(enum tag tag, std::uint64_t value, allocator_type const&) noexcept: span{ tag, value } { }
+  span(enum tag tag, double value, unsigned precision, allocator_type const&) noexcept:
+    span{ tag, value, precision } { }
+
+
+  // Span pointing at text owned by the caller, it has to outlive rendering
+  static span ref(enum tag tag, std::string_view text) noexcept {
+    span borrowed;
+    borrowed.set_external(text.data() != nullptr ? text.data() : "", text.size());
+    borrowed.set(tag, storage::borrowed);
+    return borrowed;
+  }
+
+
+  static span ref(std::string_view text) noexcept {
+    return ref(tag::normal, text);
+  }
 
-  span(enum tag tag, std::string text) noexcept:
-    tag_{tag}, text_{std::move(text)}
-  { }
 
-  explicit span(std::string text) noexcept:
-    tag_{tag::normal}, text_{std::move(text)}
-  { }
+  // points at the text of another span, a number is copied digits and all
+  static span borrow(span const& other) noexcept {
+    if (other.kind() == value_kind::text)
+      return ref(other.tag(), other.text());
+    span copy;
+    std::memcpy(copy.local_, other.local_, inline_capacity);
+    copy.local_size_ = other.local_size_;
+    copy.bits_ = other.bits_;
+    return copy;
+  }
+
+
+  // placeholder named by text, a filled value takes over its tag
+  static span slot(enum tag tag, std::string_view name,
+                   allocator_type const& allocator = pmr::allocator()) {
+    span placeholder{ tag, name, allocator };
+    placeholder.bits_ |= slot_flag;
+    return placeholder;
+  }
+
+
+  static span slot(std::string_view name, allocator_type const& allocator = pmr::allocator()) {
+    return slot(tag::normal, name, allocator);
+  }
 
 private:
 
-  enum tag tag_;
-  std::string text_;
+  enum class storage: std::uint8_t {
+    local = 0x00, heap = 0x08, borrowed = 0x10,
+    integer = 0x18, unsigned_integer = 0x20, floating = 0x28, owned = 0x30
+  };
+  static constexpr std::uint8_t tag_mask = 0x07;
+  static constexpr std::uint8_t storage_mask = 0x38;
+  static constexpr std::uint8_t slot_flag = 0x40;
+
+  struct external_text {
+    char const* data;
+    size_type size;
+  };
+
+  // heap text is preceded by the resource it came from
+  static constexpr size_type header_size = sizeof(std::pmr::memory_resource*);
+  // a floating point value is followed by its width and digits that fit
+  static constexpr size_type width_offset = sizeof(double);
+  static constexpr size_type digits_offset = width_offset + 1;
+  static constexpr size_type cached_digits = inline_capacity - digits_offset;
+  static_assert(uformat::continuous_texter::max_number_size <= 255);
+
+  alignas(external_text) char local_[inline_capacity];
+  std::uint8_t local_size_{ 0 };
+  std::uint8_t bits_{ std::uint8_t(tag::normal) };
+
+
+  enum storage storage() const noexcept { return static_cast<enum storage>(bits_ & storage_mask); }
+
+  void set(enum tag tag, enum storage storage) noexcept {
+    bits_ = std::uint8_t(std::uint8_t(tag) | std::uint8_t(storage));
+  }
+
+  external_text external() const noexcept {
+    external_text e;
+    std::memcpy(&e, local_, sizeof(e));
+    return e;
+  }
+
+  void set_external(char const* data, size_type size) noexcept {
+    external_text const e{ data, size };
+    std::memcpy(local_, &e, sizeof(e));
+  }
+
+  std::string* owned() const noexcept {
+    std::string* p;
+    std::memcpy(&p, local_, sizeof(p));
+    return p;
+  }
+
+  template<typename T>
+  T value() const noexcept {
+    T x;
+    std::memcpy(&x, local_, sizeof(x));
+    return x;
+  }
+
+  // an integer has 20 digits at most, they always fit
+  template<typename T>
+  void set_integer(enum tag tag, enum storage storage, T x) noexcept {
+    char digits[uformat::continuous_texter::max_number_size];
+    auto const width = size_type(uformat::continuous_texter::format(x, digits) - digits);
+    std::memcpy(local_, digits, width);
+    local_size_ = std::uint8_t(width);
+    set(tag, storage);
+  }
+
+  template<typename T>
+  T parse() const noexcept {
+    T x{ 0 };
+    std::from_chars(local_, local_ + local_size_, x);
+    return x;
+  }
+
+  static std::pmr::memory_resource* resource(char const* data) noexcept {
+    std::pmr::memory_resource* r;
+    std::memcpy(&r, data - header_size, sizeof(r));
+    return r;
+  }
+
+
+  void assign(enum tag tag, std::string_view text, std::pmr::memory_resource* resource) {
+    if (text.size() <= inline_capacity) {
+      if (!text.empty())
+        std::memcpy(local_, text.data(), text.size());
+      local_size_ = std::uint8_t(text.size());
+      set(tag, storage::local);
+      return;
+    }
+    auto* const block = static_cast<char*>(resource->allocate(header_size + text.size(),
+                                                              alignof(std::pmr::memory_resource*)));
+    std::memcpy(block, &resource, header_size);
+    std::memcpy(block + header_size, text.data(), text.size());
+    set_external(block + header_size, text.size());
+    set(tag, storage::heap);
+  }
+
+
+  void take(span& other) noexcept {
+    std::memcpy(local_, other.local_, inline_capacity);
+    local_size_ = other.local_size_;
+    bits_ = other.bits_;
+    other.local_size_ = 0;
+    other.bits_ = std::uint8_t(tag::normal);
+  }
+
+
+  void release() noexcept {
+    if (storage() == storage::owned) {
+      delete owned();
+      return;
+    }
+    if (storage() != storage::heap)
+      return;
+    auto const e = external();
+    char* const block = const_cast<char*>(e.data) - header_size;
+    resource(e.data)->deallocate(block, header_size + e.size, alignof(std::pmr::memory_resource*));
+  }
 };
 
 
 class text {
 public:
 
-  using items_type = std::list<span>;
+  using items_type = std::pmr::vector<span>;
   using const_iterator = items_type::const_iterator;
   using size_type = items_type::size_type;
+  using allocator_type = pmr::allocator_type;
 
-  text() = default;
+  text() noexcept: text{ pmr::allocator() } { }
+  explicit text(allocator_type const& allocator) noexcept: items_{ allocator } { }
   text(text const&) = delete;
   text& operator = (text const&) = delete;
-  text(text&&) = default;
-  text& operator = (text&&) = default;  
+  text(text&& other) noexcept:
+    items_{ std::move(other.items_) }, length_{ other.length_ }, borrowed_{ other.borrowed_ },
+    fingerprint_{ other.fingerprint_.load(std::memory_order_relaxed) },
+    revision_{ other.revision_ } {
+    other.forget();
+  }
+
+  text(text&& other, allocator_type const& allocator):
+    items_{ std::move(other.items_), allocator }, length_{ other.length_ }, borrowed_{ other.borrowed_ },
+    fingerprint_{ other.fingerprint_.load(std::memory_order_relaxed) },
+    revision_{ other.revision_ } {
+    other.forget();
+  }
+
+  text& operator = (text&& other) {
+    items_ = std::move(other.items_);
+    length_ = other.length_;
+    borrowed_ = other.borrowed_;
+    fingerprint_.store(other.fingerprint_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    revision_ = detail::next_revision();
+    other.forget();
+    return *this;
+  }
+
   const_iterator begin() const noexcept { return items_.begin(); }
   const_iterator end() const noexcept { return items_.end(); }
   bool empty() const noexcept { return items_.empty(); }
   size_type count() const noexcept { return items_.size(); }
   size_type length() const noexcept { return length_; }
+  span const& at(size_type i) const noexcept { return items_[i]; }
+  allocator_type get_allocator() const noexcept { return items_.get_allocator(); }
+  // new with every change, including being assigned over
+  std::uint64_t revision() const noexcept { return revision_; }
+  // whether any span points at text the caller may change behind its back
+  bool borrows() const noexcept { return borrowed_ != 0; }
+
+  // Computed on first use, then extended by add() and dropped by changes.
+  // Renders sharing the text may compute it at once, they store the same.
+  // Borrowed text can change without the text knowing, so a fingerprint
+  // of it is computed every time and never kept.
+  std::uint64_t fingerprint() const noexcept {
+    auto h = fingerprint_.load(std::memory_order_relaxed);
+    if (h != 0)
+      return h;
+    h = detail::hash_seed;
+    for (auto const& span: items_)
+      h = detail::combine(h, span.fingerprint());
+    if (borrowed_ == 0)
+      fingerprint_.store(h, std::memory_order_relaxed);
+    return h;
+  }
 
-  explicit text(std::string text) : length_{ text.size() } {
-    items_.emplace_back(span{ std::move(text) });
+  explicit text(std::string_view text, allocator_type const& allocator = pmr::allocator()):
+    items_{ allocator }, length_{ text.size() } {
+    items_.emplace_back(text);
   }
 
   
+  void clear() noexcept {
+    items_.clear();
+    length_ = 0;
+    borrowed_ = 0;
+    fingerprint_.store(0, std::memory_order_relaxed);
+    revision_ = detail::next_revision();
+  }
+
+
   text&& add(span span) {
     length_ += span.length();
     items_.emplace_back(std::move(span));    
-    return std::move(*this);
+    return extend();
   }
 
 
-  text&& add(std::string text) {
+  text&& add(std::string_view text) {
     length_ += text.length();
-    items_.emplace_back(span{ std::move(text) });    
-    return std::move(*this);
+    items_.emplace_back(text);    
+    return extend();
   }
 
 
-  text&& add(tag tag, std::string text) {
+  text&& add(tag tag, std::string_view text) {
     length_ += text.length();
-    items_.emplace_back(span{ tag, std::move(text) });
-    return std::move(*this);
+    items_.emplace_back(tag, text);
+    return extend();
+  }
+
+
+  // a long string moved in is kept rather than copied
+  template<typename S, typename = detail::if_owned_string<S>>
+  text&& add(S&& text) {
+    return add(tag::normal, std::move(text));
+  }
+
+
+  template<typename S, typename = detail::if_owned_string<S>>
+  text&& add(tag tag, S&& text) {
+    length_ += text.length();
+    items_.emplace_back(tag, std::move(text));
+    return extend();
+  }
+
+
+  text&& add_ref(std::string_view text) {
+    return add(span::ref(text));
+  }
+
+
+  text&& add_ref(tag tag, std::string_view text) {
+    return add(span::ref(tag, text));
+  }
+
+
+  text&& add_slot(std::string_view name) {
+    return add(span::slot(name, items_.get_allocator()));
+  }
+
+
+  text&& add_slot(tag tag, std::string_view name) {
+    return add(span::slot(tag, name, items_.get_allocator()));
+  }
+
+
+  // In-place changes keep length() up to date and return false for a
+  // position out of range. Spans after a removed one move down by one.
+  bool replace(size_type i, span span) {
+    if (i >= items_.size())
+      return false;
+    length_ = length_ - items_[i].length() + span.length();
+    borrowed_ = borrowed_ - items_[i].borrowed() + span.borrowed();
+    items_[i] = richtext::span{ std::move(span), items_.get_allocator() };
+    fingerprint_.store(0, std::memory_order_relaxed);
+    revision_ = detail::next_revision();
+    return true;
+  }
+
+
+  bool remove(size_type i) {
+    if (i >= items_.size())
+      return false;
+    length_ -= items_[i].length();
+    borrowed_ -= items_[i].borrowed();
+    items_.erase(items_.begin() + i);
+    fingerprint_.store(0, std::memory_order_relaxed);
+    revision_ = detail::next_revision();
+    return true;
   }
 
 private:
 
   items_type items_;
   size_type length_{ 0 };
+  // spans pointing at the caller's text
+  size_type borrowed_{ 0 };
+  // zero until computed
+  mutable std::atomic<std::uint64_t> fingerprint_{ 0 };
+  std::uint64_t revision_{ detail::next_revision() };
+
+
+  text&& extend() noexcept {
+    revision_ = detail::next_revision();
+    if (items_.back().borrowed()) {
+      ++borrowed_;
+      fingerprint_.store(0, std::memory_order_relaxed);
+      return std::move(*this);
+    }
+    auto const h = fingerprint_.load(std::memory_order_relaxed);
+    if (h != 0)
+      fingerprint_.store(detail::combine(h, items_.back().fingerprint()), std::memory_order_relaxed);
+    return std::move(*this);
+  }
+
+
+  // a text moved from is left empty
+  void forget() noexcept {
+    items_.clear();
+    length_ = 0;
+    borrowed_ = 0;
+    fingerprint_.store(0, std::memory_order_relaxed);
+    revision_ = detail::next_revision();
+  }
 };
 
 
 class paragraph {
 public:
 
-  paragraph() = default;
+  using allocator_type = pmr::allocator_type;
+  using size_type = std::pmr::vector<span>::size_type;
+
+  paragraph() noexcept: paragraph{ pmr::allocator() } { }
+  explicit paragraph(allocator_type const& allocator) noexcept: text_{ allocator } { }
   paragraph(paragraph const&) = delete;
   paragraph& operator = (paragraph const&) = delete;
   paragraph(paragraph&&) = default;
   paragraph& operator = (paragraph&&) = default;
-  explicit paragraph(text text) noexcept: text_{std::move(text)} { }
-  explicit paragraph(std::string text) noexcept: text_{std::move(text)} { }
-  text const& text() const noexcept { return text_; }
+  paragraph(paragraph&& other, allocator_type const& allocator):
+    text_{ std::move(other.text_), allocator } { }
+  explicit paragraph(class text text, allocator_type const& allocator = pmr::allocator()):
+    text_{ std::move(text), allocator } { }
+  explicit paragraph(std::string_view text, allocator_type const& allocator = pmr::allocator()):
+    text_{ text, allocator } { }
+  class text const& text() const noexcept { return text_; }
+  allocator_type get_allocator() const noexcept { return text_.get_allocator(); }
 
   paragraph&& add(span span) {
     text_.add(std::move(span));
@@ -121,53 +750,198 @@ public:
   }
 
 
-  paragraph&& add(std::string text) {
-    text_.add(span{ std::move(text) });
+  paragraph&& add(std::string_view text) {
+    text_.add(text);
+    return std::move(*this);
+  }
+
+
+  paragraph&& add(tag tag, std::string_view text) {
+    text_.add(tag, text);
+    return std::move(*this);
+  }
+
+
+  template<typename S, typename = detail::if_owned_string<S>>
+  paragraph&& add(S&& text) {
+    text_.add(std::move(text));
+    return std::move(*this);
+  }
+
+
+  template<typename S, typename = detail::if_owned_string<S>>
+  paragraph&& add(tag tag, S&& text) {
+    text_.add(tag, std::move(text));
+    return std::move(*this);
+  }
+
+
+  paragraph&& add_ref(std::string_view text) {
+    text_.add_ref(text);
+    return std::move(*this);
+  }
+
+
+  paragraph&& add_ref(tag tag, std::string_view text) {
+    text_.add_ref(tag, text);
     return std::move(*this);
   }
 
+  paragraph&& add_slot(std::string_view name) {
+    text_.add_slot(name);
+    return std::move(*this);
+  }
 
-  paragraph&& add(tag tag, std::string text) {
-    text_.add(span{ tag, std::move(text) });
+  paragraph&& add_slot(tag tag, std::string_view name) {
+    text_.add_slot(tag, name);
     return std::move(*this);
   }
 
+  void replace_text(class text text) {
+    text_ = richtext::text{ std::move(text), text_.get_allocator() };
+  }
+
+  // false for a span out of range
+  bool replace(size_type i, span span) { return text_.replace(i, std::move(span)); }
+  bool remove(size_type i) { return text_.remove(i); }
+
 private:
 
   class text text_;
 };
 
 
-using table_header = std::vector<std::string>;
+using table_header = std::pmr::vector<pmr::string>;
+
+
+// Names a row of a table for as long as it's there. Unlike its position
+// it doesn't change when an earlier row is removed. A default id names
+// nothing.
+struct row_id {
+  std::uint64_t value{ 0 };
+
+  friend bool operator == (row_id lhs, row_id rhs) noexcept { return lhs.value == rhs.value; }
+  friend bool operator != (row_id lhs, row_id rhs) noexcept { return lhs.value != rhs.value; }
+};
+
+
+// the same for an item of a document, section or subsection
+struct node_id {
+  std::uint64_t value{ 0 };
+
+  friend bool operator == (node_id lhs, node_id rhs) noexcept { return lhs.value == rhs.value; }
+  friend bool operator != (node_id lhs, node_id rhs) noexcept { return lhs.value != rhs.value; }
+};
 
 
 class table_row {
 public:
 
-  using items_type = std::vector<span>;
+  using items_type = std::pmr::vector<span>;
   using size_type = items_type::size_type;
   using const_iterator = items_type::const_iterator;
+  using allocator_type = pmr::allocator_type;
 
-  table_row() = default;
+  table_row() noexcept: table_row{ pmr::allocator() } { }
+  explicit table_row(allocator_type const& allocator) noexcept: items_{ allocator } { }
   table_row(table_row const&) = delete;
   table_row& operator = (table_row const&) = delete;
   table_row(table_row&&) = default;
   table_row& operator = (table_row&&) = default;
+  table_row(table_row&& other, allocator_type const& allocator):
+    items_{ std::move(other.items_), allocator } { }
   size_type size() const noexcept { return items_.size(); }
   const_iterator begin() const noexcept { return items_.begin(); }
   const_iterator end() const noexcept { return items_.end(); }
   span const& at(size_type i) const noexcept { return items_[i]; }
+  allocator_type get_allocator() const noexcept { return items_.get_allocator(); }
+  void clear() noexcept { items_.clear(); }
+
+  table_row&& add(span value) {
+    items_.emplace_back(std::move(value));
+    return std::move(*this);
+  }
+
+  table_row&& add(std::string_view text) {
+    items_.emplace_back(text);
+    return std::move(*this);
+  }
+
+  table_row&& add(tag tag, std::string_view text) {
+    items_.emplace_back(tag, text);
+    return std::move(*this);
+  }
+
+  template<typename S, typename = detail::if_owned_string<S>>
+  table_row&& add(S&& text) {
+    return add(tag::normal, std::move(text));
+  }
+
+  template<typename S, typename = detail::if_owned_string<S>>
+  table_row&& add(tag tag, S&& text) {
+    items_.emplace_back(tag, std::move(text));
+    return std::move(*this);
+  }
+
+  // numbers are stored as they are and printed straight into the output
+  template<typename T, typename = std::enable_if_t<std::is_integral_v<T> && !std::is_same_v<T, bool>>>
+  table_row&& add(T value) {
+    return add(tag::normal, value);
+  }
+
+  template<typename T, typename = std::enable_if_t<std::is_integral_v<T> && !std::is_same_v<T, bool>>>
+  table_row&& add(tag tag, T value) {
+    if constexpr (std::is_signed_v<T>)
+      items_.emplace_back(tag, std::int64_t(value));
+    else
+      items_.emplace_back(tag, std::uint64_t(value));
+    return std::move(*this);
+  }
+
+  table_row&& add(double value, unsigned precision) {
+    items_.emplace_back(tag::normal, value, precision);
+    return std::move(*this);
+  }
+
+  table_row&& add(tag tag, double value, unsigned precision) {
+    items_.emplace_back(tag, value, precision);
+    return std::move(*this);
+  }
+
+  table_row&& add_ref(std::string_view text) {
+    items_.push_back(span::ref(text));
+    return std::move(*this);
+  }
+
+  table_row&& add_ref(tag tag, std::string_view text) {
+    items_.push_back(span::ref(tag, text));
+    return std::move(*this);
+  }
 
-  table_row&& add(std::string text) {
-    items_.emplace_back(span{ std::move(text) });
+  table_row&& add_slot(std::string_view name) {
+    items_.push_back(span::slot(name, items_.get_allocator()));
     return std::move(*this);
   }
 
-  table_row&& add(tag tag, std::string text) {
-    items_.emplace_back(span{ tag, std::move(text) });
+  table_row&& add_slot(tag tag, std::string_view name) {
+    items_.push_back(span::slot(tag, name, items_.get_allocator()));
     return std::move(*this);
   }
 
+  bool set(size_type i, span value) {
+    if (i >= items_.size())
+      return false;
+    items_[i] = span{ std::move(value), items_.get_allocator() };
+    return true;
+  }
+
+  // copies borrowed text, for a row kept past the life of what it points at
+  void own() {
+    for (auto& item: items_)
+      if (item.borrowed())
+        item = span{ item.tag(), item.text(), items_.get_allocator() };
+  }
+
 
 private:
 
@@ -178,90 +952,645 @@ private:
 class table {
 public:
 
-  using rows_type = std::list<table_row>;
+  using rows_type = std::pmr::vector<table_row>;
   using const_iterator = rows_type::const_iterator;
   using size_type = rows_type::size_type;
+  using allocator_type = pmr::allocator_type;
 
-  table() = default;
+  table() noexcept: table{ pmr::allocator() } { }
+  explicit table(allocator_type const& allocator) noexcept:
+    header_{ allocator }, rows_{ allocator }, ids_{ allocator } { }
   table(table const&) = delete;
   table& operator = (table const&) = delete;
-  table(table&&) = default;
-  table& operator = (table&&) = default;
-  explicit table(table_header header) noexcept: header_{std::move(header)} { }
+  table(table&& other) noexcept:
+    header_{ std::move(other.header_) }, rows_{ std::move(other.rows_) }, ids_{ std::move(other.ids_) },
+    borrowed_{ other.borrowed_ },
+    fingerprint_{ other.fingerprint_.load(std::memory_order_relaxed) },
+    revision_{ other.revision_ } {
+    other.forget();
+  }
+
+  table(table&& other, allocator_type const& allocator):
+    header_{ std::move(other.header_), allocator }, rows_{ std::move(other.rows_), allocator },
+    ids_{ std::move(other.ids_), allocator }, borrowed_{ other.borrowed_ },
+    fingerprint_{ other.fingerprint_.load(std::memory_order_relaxed) },
+    revision_{ other.revision_ } {
+    other.forget();
+  }
+
+  table& operator = (table&& other) {
+    header_ = std::move(other.header_);
+    rows_ = std::move(other.rows_);
+    ids_ = std::move(other.ids_);
+    borrowed_ = other.borrowed_;
+    fingerprint_.store(other.fingerprint_.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    revision_ = detail::next_revision();
+    other.forget();
+    return *this;
+  }
+
+  explicit table(table_header header, allocator_type const& allocator = pmr::allocator()):
+    header_{ std::move(header), allocator }, rows_{ allocator }, ids_{ allocator } { }
   table_header const& header() const noexcept { return header_; }
   const_iterator begin() const noexcept { return rows_.begin(); }
   const_iterator end() const noexcept { return rows_.end(); }
   size_type columns_count() const noexcept { return header_.size(); }
   size_type rows_count() const noexcept { return rows_.size(); }
+  table_row const& at(size_type row) const noexcept { return rows_[row]; }
+  allocator_type get_allocator() const noexcept { return rows_.get_allocator(); }
+  std::uint64_t revision() const noexcept { return revision_; }
+  // whether any cell points at text the caller may change behind its back
+  bool borrows() const noexcept { return borrowed_ != 0; }
   
   table&& add(table_row row) {
     if (row.size() != header_.size())
       return std::move(*this);
     rows_.emplace_back(std::move(row));
+    ids_.push();
+    revision_ = detail::next_revision();
+    auto const borrowed = borrowed_cells(rows_.back());
+    if (borrowed != 0) {
+      borrowed_ += borrowed;
+      fingerprint_.store(0, std::memory_order_relaxed);
+      return std::move(*this);
+    }
+    auto const h = fingerprint_.load(std::memory_order_relaxed);
+    if (h != 0)
+      fingerprint_.store(detail::combine(h, fingerprint(rows_.back())), std::memory_order_relaxed);
     return std::move(*this);
   }
 
+  // Computed on first use, then extended by add() and dropped by changes.
+  // Renders sharing the table may compute it at once, they store the same.
+  // Like text's, it isn't kept while a cell is borrowed.
+  std::uint64_t fingerprint() const noexcept {
+    auto h = fingerprint_.load(std::memory_order_relaxed);
+    if (h != 0)
+      return h;
+    h = detail::hash_seed;
+    for (auto const& column: header_)
+      h = detail::combine(h, detail::hash(detail::hash_seed, column));
+    for (auto const& row: rows_)
+      h = detail::combine(h, fingerprint(row));
+    if (borrowed_ == 0)
+      fingerprint_.store(h, std::memory_order_relaxed);
+    return h;
+  }
+
+  // adds like add(row) and names the row by id, a default id when skipped
+  table&& add(table_row row, row_id& id) {
+    auto const rows = rows_.size();
+    add(std::move(row));
+    id = rows_.size() != rows ? row_id{ ids_.back() } : row_id{};
+    return std::move(*this);
+  }
+
+  // the row named by id, nullptr once it's removed
+  table_row const* find(row_id id) const noexcept {
+    auto const i = ids_.find(id.value);
+    return i != detail::item_ids::npos ? &rows_[i] : nullptr;
+  }
+
+  bool set_cell(row_id row, size_type column, span value) {
+    auto const i = ids_.find(row.value);
+    return i != detail::item_ids::npos && set_cell(i, column, std::move(value));
+  }
+
+  bool remove(row_id row) {
+    auto const i = ids_.find(row.value);
+    return i != detail::item_ids::npos && remove(i);
+  }
+
+  // rows and columns by position, false when out of range
+  bool set_cell(size_type row, size_type column, span value) {
+    if (row >= rows_.size() || column >= header_.size())
+      return false;
+    borrowed_ = borrowed_ - rows_[row].at(column).borrowed() + value.borrowed();
+    rows_[row].set(column, std::move(value));
+    fingerprint_.store(0, std::memory_order_relaxed);
+    revision_ = detail::next_revision();
+    return true;
+  }
+
+  // rows after the removed one move up
+  bool remove(size_type row) {
+    if (row >= rows_.size())
+      return false;
+    borrowed_ -= borrowed_cells(rows_[row]);
+    rows_.erase(rows_.begin() + row);
+    ids_.erase(row);
+    fingerprint_.store(0, std::memory_order_relaxed);
+    revision_ = detail::next_revision();
+    return true;
+  }
+
 private:
 
   table_header header_;
   rows_type rows_;
+  detail::item_ids ids_;
+  // cells pointing at the caller's text
+  size_type borrowed_{ 0 };
+  // zero until computed
+  mutable std::atomic<std::uint64_t> fingerprint_{ 0 };
+  std::uint64_t revision_{ detail::next_revision() };
+
+
+  // a table moved from is left empty
+  void forget() noexcept {
+    header_.clear();
+    rows_.clear();
+    ids_.clear();
+    borrowed_ = 0;
+    fingerprint_.store(0, std::memory_order_relaxed);
+    revision_ = detail::next_revision();
+  }
+
+
+  static size_type borrowed_cells(table_row const& row) noexcept {
+    size_type n = 0;
+    for (auto const& cell: row)
+      n += cell.borrowed();
+    return n;
+  }
+
+
+  static std::uint64_t fingerprint(table_row const& row) noexcept {
+    auto h = detail::hash_seed;
+    for (auto const& cell: row)
+      h = detail::combine(h, cell.fingerprint());
+    return h;
+  }
+};
+
+
+// Table held as whole columns of numbers or strings. Values are borrowed
+// from the caller and have to outlive rendering. Each column keeps the
+// width of its widest value, so rendering walks rows across the column
+// arrays without measuring or building rows.
+class columnar_table {
+public:
+
+  using size_type = std::size_t;
+  using allocator_type = pmr::allocator_type;
+
+  struct statistics {
+    size_type width{ 0 };
+    // smallest and largest value of a numeric column
+    double min{ 0 };
+    double max{ 0 };
+  };
+
+
+  class column {
+  public:
+
+    enum value_kind kind() const noexcept { return kind_; }
+    size_type size() const noexcept { return size_; }
+    statistics const& stats() const noexcept { return stats_; }
+    bool dictionary() const noexcept { return codes_ != nullptr; }
+
+
+    span cell(size_type row) const noexcept {
+      switch (kind_) {
+        case value_kind::integer:
+          return span{ tag::normal, static_cast<std::int64_t const*>(values_)[row] };
+        case value_kind::unsigned_integer:
+          return span{ tag::normal, static_cast<std::uint64_t const*>(values_)[row] };
+        case value_kind::floating:
+          return span{ tag::normal, static_cast<double const*>(values_)[row], precision_ };
+        default: {
+          auto const* const strings = static_cast<std::string_view const*>(values_);
+          return span::ref(codes_ != nullptr ? strings[codes_[row]] : strings[row]);
+        }
+      }
+    }
+
+  private:
+
+    friend class columnar_table;
+
+    enum value_kind kind_{ value_kind::text };
+    unsigned precision_{ 0 };
+    void const* values_{ nullptr };
+    std::uint32_t const* codes_{ nullptr };
+    size_type size_{ 0 };
+    statistics stats_;
+  };
+
+  using columns_type = std::pmr::vector<column>;
+  using const_iterator = columns_type::const_iterator;
+
+  columnar_table() noexcept: columnar_table{ pmr::allocator() } { }
+  explicit columnar_table(allocator_type const& allocator) noexcept:
+    header_{ allocator }, columns_{ allocator } { }
+  columnar_table(columnar_table const&) = delete;
+  columnar_table& operator = (columnar_table const&) = delete;
+  columnar_table(columnar_table&&) = default;
+  columnar_table& operator = (columnar_table&&) = default;
+  columnar_table(columnar_table&& other, allocator_type const& allocator):
+    header_{ std::move(other.header_), allocator }, columns_{ std::move(other.columns_), allocator },
+    rows_{ other.rows_ } { }
+  table_header const& header() const noexcept { return header_; }
+  const_iterator begin() const noexcept { return columns_.begin(); }
+  const_iterator end() const noexcept { return columns_.end(); }
+  column const& at(size_type i) const noexcept { return columns_[i]; }
+  size_type columns_count() const noexcept { return columns_.size(); }
+  size_type rows_count() const noexcept { return rows_; }
+  allocator_type get_allocator() const noexcept { return columns_.get_allocator(); }
+
+  // columns of a length other than the first one's are ignored
+
+  columnar_table&& add_column(std::string_view header, std::int64_t const* values, size_type size) {
+    return add(header, make_integers(values, size, value_kind::integer));
+  }
+
+
+  columnar_table&& add_column(std::string_view header, std::uint64_t const* values, size_type size) {
+    return add(header, make_integers(values, size, value_kind::unsigned_integer));
+  }
+
+
+  columnar_table&& add_column(std::string_view header, double const* values, size_type size,
+                              unsigned precision) {
+    column c;
+    c.kind_ = value_kind::floating;
+    c.precision_ = precision > 16 ? 16 : precision;
+    c.values_ = values;
+    c.size_ = size;
+    bool finite = false;
+    // widest magnitudes printed without an exponent, on either side of zero
+    double fixed_max = -1, fixed_min = 1;
+    for (size_type i = 0; i != size; ++i) {
+      double const x = values[i];
+      if (!std::isfinite(x)) {
+        // NaN or INF, left out of the range
+        size_type const n = span{ tag::normal, x, c.precision_ }.length();
+        if (n > c.stats_.width)
+          c.stats_.width = n;
+        continue;
+      }
+      if (!finite || x < c.stats_.min)
+        c.stats_.min = x;
+      if (!finite || x > c.stats_.max)
+        c.stats_.max = x;
+      finite = true;
+      if (x >= 0 && x < exponent_limit && x > fixed_max)
+        fixed_max = x;
+      if (x < 0 && x > -exponent_limit && x < fixed_min)
+        fixed_min = x;
+    }
+    if (finite) {
+      // Width grows with magnitude within each notation, so the widest
+      // value is an end of the range or the largest one in fixed notation
+      c.stats_.width = std::max({ c.stats_.width,
+                                  span{ tag::normal, c.stats_.min, c.precision_ }.length(),
+                                  span{ tag::normal, c.stats_.max, c.precision_ }.length() });
+      if (fixed_max >= 0)
+        c.stats_.width = std::max(c.stats_.width, span{ tag::normal, fixed_max, c.precision_ }.length());
+      if (fixed_min < 0)
+        c.stats_.width = std::max(c.stats_.width, span{ tag::normal, fixed_min, c.precision_ }.length());
+    }
+    return add(header, c);
+  }
+
+
+  columnar_table&& add_column(std::string_view header, std::string_view const* values, size_type size) {
+    column c;
+    c.values_ = values;
+    c.size_ = size;
+    for (size_type i = 0; i != size; ++i)
+      if (values[i].size() > c.stats_.width)
+        c.stats_.width = values[i].size();
+    return add(header, c);
+  }
+
+
+  // strings given as codes into a dictionary of distinct values
+  columnar_table&& add_dictionary_column(std::string_view header,
+                                         std::string_view const* dictionary, size_type dictionary_size,
+                                         std::uint32_t const* codes, size_type size) {
+    column c;
+    c.values_ = dictionary;
+    c.codes_ = codes;
+    c.size_ = size;
+    for (size_type i = 0; i != size; ++i) {
+      if (codes[i] >= dictionary_size)
+        return std::move(*this);
+      if (dictionary[codes[i]].size() > c.stats_.width)
+        c.stats_.width = dictionary[codes[i]].size();
+    }
+    return add(header, c);
+  }
+
+
+  // any contiguous container: std::vector, std::array and the like
+  template<typename C>
+  auto add_column(std::string_view header, C const& values)
+    -> decltype(add_column(header, std::data(values), std::size(values))) {
+    return add_column(header, std::data(values), std::size(values));
+  }
+
+
+  template<typename C>
+  auto add_column(std::string_view header, C const& values, unsigned precision)
+    -> decltype(add_column(header, std::data(values), std::size(values), precision)) {
+    return add_column(header, std::data(values), std::size(values), precision);
+  }
+
+private:
+
+  // magnitudes from here on are printed with an exponent, see texter
+  static constexpr double exponent_limit = 18446744073709551615.0;
+
+  table_header header_;
+  columns_type columns_;
+  size_type rows_{ 0 };
+
+
+  template<typename T>
+  static column make_integers(T const* values, size_type size, enum value_kind kind) noexcept {
+    column c;
+    c.kind_ = kind;
+    c.values_ = values;
+    c.size_ = size;
+    if (size == 0)
+      return c;
+    T min = values[0], max = values[0];
+    for (size_type i = 1; i != size; ++i) {
+      if (values[i] < min)
+        min = values[i];
+      if (values[i] > max)
+        max = values[i];
+    }
+    c.stats_.min = double(min);
+    c.stats_.max = double(max);
+    c.stats_.width = std::max(span{ tag::normal, min }.length(), span{ tag::normal, max }.length());
+    return c;
+  }
+
+
+  columnar_table&& add(std::string_view header, column const& c) {
+    if (!columns_.empty() && c.size_ != rows_)
+      return std::move(*this);
+    rows_ = c.size_;
+    header_.emplace_back(header);
+    columns_.push_back(c);
+    return std::move(*this);
+  }
+};
+
+
+// Table whose rows come from a generator while it's rendered, so only a
+// row or a bounded sample of rows is held at a time. The generator fills
+// the row it's given and returns false once exhausted. The table holds a
+// source that makes a fresh generator for every render, so rendering
+// doesn't change the table and can be repeated. Column widths are either
+// given or taken from the first sample_size() rows, later rows that are
+// wider just overflow their column. Rows held for the sample get copies
+// of their borrowed text, so a generator may add_ref() a buffer it reuses
+// for every row, other rows are printed before the next one is asked for.
+class lazy_table {
+public:
+
+  using size_type = std::size_t;
+  using allocator_type = pmr::allocator_type;
+  using generator_type = std::function<bool(table_row&)>;
+  using source_type = std::function<generator_type()>;
+  using widths_type = std::vector<size_type>;
+
+  static constexpr size_type default_sample_size = 1024;
+
+  lazy_table() noexcept: lazy_table{ pmr::allocator() } { }
+  explicit lazy_table(allocator_type const& allocator) noexcept: header_{ allocator } { }
+  lazy_table(lazy_table const&) = delete;
+  lazy_table& operator = (lazy_table const&) = delete;
+  lazy_table(lazy_table&&) = default;
+  lazy_table& operator = (lazy_table&&) = default;
+  lazy_table(lazy_table&& other, allocator_type const& allocator):
+    header_{ std::move(other.header_), allocator }, source_{ std::move(other.source_) },
+    widths_{ std::move(other.widths_) }, sample_size_{ other.sample_size_ } { }
+
+  lazy_table(table_header header, source_type source,
+             allocator_type const& allocator = pmr::allocator()):
+    header_{ std::move(header), allocator }, source_{ std::move(source) } { }
+
+
+  // Rows of [first, last) are read on every render, their text is pointed
+  // at, so the range has to outlive rendering like borrowed spans do
+  template<typename It>
+  lazy_table(table_header header, It first, It last, allocator_type const& allocator = pmr::allocator()):
+    lazy_table{ std::move(header), [first, last] {
+      return generator_type{ [it = first, last](table_row& row) mutable {
+        if (it == last)
+          return false;
+        for (auto const& cell: *it)
+          row.add(span::borrow(cell));
+        ++it;
+        return true;
+      } };
+    }, allocator } { }
+
+  table_header const& header() const noexcept { return header_; }
+  size_type columns_count() const noexcept { return header_.size(); }
+  widths_type const& widths() const noexcept { return widths_; }
+  size_type sample_size() const noexcept { return sample_size_; }
+  allocator_type get_allocator() const noexcept { return header_.get_allocator(); }
+
+
+  // widths to render with instead of sampling, one per column
+  lazy_table&& widths(widths_type widths) {
+    if (widths.size() == header_.size())
+      widths_ = std::move(widths);
+    return std::move(*this);
+  }
+
+
+  lazy_table&& sample_size(size_type rows) noexcept {
+    sample_size_ = rows;
+    return std::move(*this);
+  }
+
+
+  // a generator that starts from the first row
+  generator_type rows() const {
+    return source_ ? source_() : generator_type{};
+  }
+
+private:
+
+  table_header header_;
+  source_type source_;
+  widths_type widths_;
+  size_type sample_size_{ default_sample_size };
 };
 
 
 class fragment;
-using fragment_ptr = std::unique_ptr<fragment>;
 
+
+// nested lists live in the memory resource of their parent list
+struct fragment_deleter {
+  std::pmr::memory_resource* resource;
+  void operator()(fragment* fragment) const noexcept;
+};
+
+using fragment_ptr = std::unique_ptr<fragment, fragment_deleter>;
+
+class unordered_list;
 class ordered_list;
 
 
+enum class fragment_kind {
+  undefined, paragraph, table, unordered_list, ordered_list, subsection, section, columnar_table,
+  lazy_table
+};
+
+
+// Item of a list: a paragraph is kept inline, only a nested list
+// needs a fragment of its own
+class list_item {
+public:
+
+  using allocator_type = pmr::allocator_type;
+
+  list_item() noexcept: list_item{ pmr::allocator() } { }
+  explicit list_item(allocator_type const& allocator) noexcept: paragraph_{ allocator } { }
+  list_item(list_item const&) = delete;
+  list_item& operator = (list_item const&) = delete;
+  list_item(list_item&&) = default;
+  list_item& operator = (list_item&&) = default;
+  list_item(list_item&& other, allocator_type const& allocator);
+  ~list_item();
+  explicit list_item(class paragraph paragraph, allocator_type const& allocator = pmr::allocator()):
+    paragraph_{ std::move(paragraph), allocator } { }
+  explicit list_item(class unordered_list unordered_list, allocator_type const& allocator = pmr::allocator());
+  explicit list_item(class ordered_list ordered_list, allocator_type const& allocator = pmr::allocator());
+  class paragraph const* paragraph() const noexcept { return nested_ ? nullptr : &paragraph_; }
+  class unordered_list const* unordered_list() const noexcept;
+  class ordered_list const* ordered_list() const noexcept;
+  fragment_kind kind() const noexcept;
+  allocator_type get_allocator() const noexcept { return paragraph_.get_allocator(); }
+
+private:
+
+  class paragraph paragraph_;
+  fragment_ptr nested_;
+
+  static std::pmr::vector<list_item>& items(fragment& nested) noexcept;
+  static fragment_ptr rebind(fragment& nested, allocator_type const& allocator);
+  template<typename List>
+  static fragment_ptr shell(List& list, allocator_type const& allocator);
+};
+
+
 class unordered_list {
 public:
 
-  using items_type = std::list<fragment_ptr>;
+  using items_type = std::pmr::vector<list_item>;
   using size_type = items_type::size_type;
   using const_iterator = items_type::const_iterator;
+  using allocator_type = pmr::allocator_type;
 
-  unordered_list() = default;
+  unordered_list() noexcept: unordered_list{ pmr::allocator() } { }
+  explicit unordered_list(allocator_type const& allocator) noexcept:
+    header_{ allocator }, items_{ allocator } { }
   unordered_list(unordered_list const&) = delete;
   unordered_list& operator = (unordered_list const&) = delete;
-  unordered_list(unordered_list&&) = default;
-  unordered_list& operator = (unordered_list&&) = default;
-  explicit unordered_list(std::string header) noexcept: header_{std::move(header)} { }
-  std::string const& header() const noexcept { return header_; }
+  unordered_list(unordered_list&& other) noexcept:
+    header_{ std::move(other.header_) }, items_{ std::move(other.items_) },
+    revision_{ other.revision_ } {
+    other.forget();
+  }
+
+  unordered_list(unordered_list&& other, allocator_type const& allocator):
+    header_{ std::move(other.header_), allocator }, items_{ std::move(other.items_), allocator },
+    revision_{ other.revision_ } {
+    other.forget();
+  }
+
+  unordered_list& operator = (unordered_list&& other) {
+    header_ = std::move(other.header_);
+    items_ = std::move(other.items_);
+    revision_ = detail::next_revision();
+    other.forget();
+    return *this;
+  }
+
+  explicit unordered_list(std::string_view header, allocator_type const& allocator = pmr::allocator()):
+    header_{ header, allocator }, items_{ allocator } { }
+  std::string_view header() const noexcept { return header_; }
   const_iterator begin() const noexcept { return items_.begin(); }
   const_iterator end() const noexcept { return items_.end(); }
   bool empty() const noexcept { return items_.empty(); }
   size_type size() const noexcept { return items_.size(); }
- 
+  allocator_type get_allocator() const noexcept { return items_.get_allocator(); }
+  std::uint64_t revision() const noexcept { return revision_; }
+
   unordered_list&& add(paragraph);
   unordered_list&& add(unordered_list);
   unordered_list&& add(ordered_list);
 
 private:
 
-  std::string header_;
+  friend class list_item;
+
+  pmr::string header_;
   items_type items_;
+  std::uint64_t revision_{ detail::next_revision() };
+
+
+  // a list moved from is left empty
+  void forget() noexcept {
+    header_.clear();
+    items_.clear();
+    revision_ = detail::next_revision();
+  }
 };
 
 
 class ordered_list {
 public:
 
-  using items_type = std::list<fragment_ptr>;
+  using items_type = std::pmr::vector<list_item>;
   using const_iterator = items_type::const_iterator;
   using size_type = items_type::size_type;
+  using allocator_type = pmr::allocator_type;
 
-  ordered_list() = default;
+  ordered_list() noexcept: ordered_list{ pmr::allocator() } { }
+  explicit ordered_list(allocator_type const& allocator) noexcept:
+    header_{ allocator }, items_{ allocator } { }
   ordered_list(ordered_list const&) = delete;
   ordered_list& operator = (ordered_list const&) = delete;
-  ordered_list(ordered_list&&) = default;
-  ordered_list& operator = (ordered_list&&) = default;
-  explicit ordered_list(std::string header) noexcept: header_{ std::move(header) } { }
-  std::string const& header() const noexcept { return header_; }
+  ordered_list(ordered_list&& other) noexcept:
+    header_{ std::move(other.header_) }, items_{ std::move(other.items_) },
+    revision_{ other.revision_ } {
+    other.forget();
+  }
+
+  ordered_list(ordered_list&& other, allocator_type const& allocator):
+    header_{ std::move(other.header_), allocator }, items_{ std::move(other.items_), allocator },
+    revision_{ other.revision_ } {
+    other.forget();
+  }
+
+  ordered_list& operator = (ordered_list&& other) {
+    header_ = std::move(other.header_);
+    items_ = std::move(other.items_);
+    revision_ = detail::next_revision();
+    other.forget();
+    return *this;
+  }
+
+  explicit ordered_list(std::string_view header, allocator_type const& allocator = pmr::allocator()):
+    header_{ header, allocator }, items_{ allocator } { }
+  std::string_view header() const noexcept { return header_; }
   const_iterator begin() const noexcept { return items_.begin(); }
   const_iterator end() const noexcept { return items_.end(); }
   bool empty() const noexcept { return items_.empty(); }
   size_type size() const noexcept { return items_.size(); }
+  allocator_type get_allocator() const noexcept { return items_.get_allocator(); }
+  std::uint64_t revision() const noexcept { return revision_; }
 
   ordered_list&& add(paragraph);
   ordered_list&& add(unordered_list);
@@ -269,35 +1598,66 @@ public:
 
 private:
 
-  std::string header_;
+  friend class list_item;
+
+  pmr::string header_;
   items_type items_;
-};
+  std::uint64_t revision_{ detail::next_revision() };
 
 
-enum class fragment_kind {
-  undefined, paragraph, table, unordered_list, ordered_list, subsection, section
+  // a list moved from is left empty
+  void forget() noexcept {
+    header_.clear();
+    items_.clear();
+    revision_ = detail::next_revision();
+  }
 };
 
 
 class fragment {
 public:
 
-  using item_type = std::variant<std::monostate, paragraph, table,
-                                 unordered_list, ordered_list>;
+  using item_type = std::variant<std::monostate, class paragraph, class table,
+                                 class unordered_list, class ordered_list,
+                                 class columnar_table, class lazy_table>;
+  using allocator_type = pmr::allocator_type;
 
   fragment() = default;
   fragment(fragment const&) = delete;
   fragment& operator = (fragment const&) = delete;
   fragment(fragment&&) = default;
   fragment& operator = (fragment&&) = default;
-  explicit fragment(paragraph paragraph) noexcept: item_{std::move(paragraph)} { }
-  explicit fragment(table table) noexcept: item_{std::move(table)} { }
-  explicit fragment(unordered_list unordered_list) noexcept : item_{std::move(unordered_list)} { }
-  explicit fragment(ordered_list ordered_list) noexcept: item_{std::move(ordered_list)} { }
-  paragraph const* paragraph() const noexcept { return std::get_if<class paragraph>(&item_); }
-  table const* table() const noexcept { return std::get_if<class table>(&item_); }
-  unordered_list const* unordered_list() const noexcept { return std::get_if<class unordered_list>(&item_); }
-  ordered_list const* ordered_list() const noexcept { return std::get_if<class ordered_list>(&item_); }
+  fragment(fragment&& other, allocator_type const& allocator):
+    item_{ pmr::detail::rebind(std::move(other.item_), allocator) } { }
+  explicit fragment(class paragraph paragraph) noexcept: item_{std::move(paragraph)} { }
+  explicit fragment(class table table) noexcept: item_{std::move(table)} { }
+  explicit fragment(class columnar_table columnar_table) noexcept: item_{std::move(columnar_table)} { }
+  explicit fragment(class lazy_table lazy_table) noexcept: item_{std::move(lazy_table)} { }
+  explicit fragment(class unordered_list unordered_list) noexcept : item_{std::move(unordered_list)} { }
+  explicit fragment(class ordered_list ordered_list) noexcept: item_{std::move(ordered_list)} { }
+  fragment(class paragraph paragraph, allocator_type const& allocator):
+    item_{ std::in_place_type<class paragraph>, std::move(paragraph), allocator } { }
+  fragment(class table table, allocator_type const& allocator):
+    item_{ std::in_place_type<class table>, std::move(table), allocator } { }
+  fragment(class columnar_table columnar_table, allocator_type const& allocator):
+    item_{ std::in_place_type<class columnar_table>, std::move(columnar_table), allocator } { }
+  fragment(class lazy_table lazy_table, allocator_type const& allocator):
+    item_{ std::in_place_type<class lazy_table>, std::move(lazy_table), allocator } { }
+  fragment(class unordered_list unordered_list, allocator_type const& allocator):
+    item_{ std::in_place_type<class unordered_list>, std::move(unordered_list), allocator } { }
+  fragment(class ordered_list ordered_list, allocator_type const& allocator):
+    item_{ std::in_place_type<class ordered_list>, std::move(ordered_list), allocator } { }
+  class paragraph const* paragraph() const noexcept { return std::get_if<class paragraph>(&item_); }
+  class table const* table() const noexcept { return std::get_if<class table>(&item_); }
+  class columnar_table const* columnar_table() const noexcept { return std::get_if<class columnar_table>(&item_); }
+  class lazy_table const* lazy_table() const noexcept { return std::get_if<class lazy_table>(&item_); }
+  class unordered_list const* unordered_list() const noexcept { return std::get_if<class unordered_list>(&item_); }
+  class ordered_list const* ordered_list() const noexcept { return std::get_if<class ordered_list>(&item_); }
+
+  class paragraph* paragraph() noexcept { return std::get_if<class paragraph>(&item_); }
+  class table* table() noexcept { return std::get_if<class table>(&item_); }
+  class unordered_list* unordered_list() noexcept { return std::get_if<class unordered_list>(&item_); }
+  class ordered_list* ordered_list() noexcept { return std::get_if<class ordered_list>(&item_); }
 
   fragment_kind kind() const noexcept {
     switch(item_.index()) {
@@ -305,6 +1665,8 @@ public:
       case 2  : return fragment_kind::table;
       case 3  : return fragment_kind::unordered_list;
       case 4  : return fragment_kind::ordered_list;
+      case 5  : return fragment_kind::columnar_table;
+      case 6  : return fragment_kind::lazy_table;
       default : return fragment_kind::undefined;
     }
   }
@@ -315,85 +1677,311 @@ private:
 };
 
 
+inline void fragment_deleter::operator()(fragment* fragment) const noexcept {
+  fragment->~fragment();
+  resource->deallocate(fragment, sizeof(class fragment), alignof(class fragment));
+}
+
+
+template<typename T>
+fragment_ptr make_fragment(T&& item, pmr::allocator_type const& allocator) {
+  auto* const resource = allocator.resource();
+  void* const memory = resource->allocate(sizeof(fragment), alignof(fragment));
+  try {
+    return fragment_ptr{ new (memory) fragment{ std::forward<T>(item), allocator },
+                         fragment_deleter{ resource } };
+  } catch(...) {
+    resource->deallocate(memory, sizeof(fragment), alignof(fragment));
+    throw;
+  }
+}
+
+
+inline list_item::list_item(list_item&& other, allocator_type const& allocator):
+  paragraph_{ std::move(other.paragraph_), allocator } {
+  if (!other.nested_)
+    return;
+  if (other.nested_.get_deleter().resource == allocator.resource())
+    nested_ = std::move(other.nested_);
+  else
+    nested_ = rebind(*other.nested_, allocator);
+}
+
+
+// Nested lists are moved level by level from a heap stack, so moving a
+// list thousands of levels deep into another allocator doesn't recurse.
+// Each level gets a fragment holding an empty list first, its items are
+// moved in without their nested lists, which wait on the stack.
+inline fragment_ptr list_item::rebind(fragment& nested, allocator_type const& allocator) {
+  struct pending_move {
+    fragment* from;
+    fragment_ptr* to;
+  };
+
+  fragment_ptr moved;
+  std::vector<pending_move> pending{ pending_move{ &nested, &moved } };
+  while (!pending.empty()) {
+    auto const next = pending.back();
+    pending.pop_back();
+    if (auto* list = next.from->unordered_list())
+      *next.to = shell(*list, allocator);
+    else
+      *next.to = shell(*next.from->ordered_list(), allocator);
+    auto& from = items(*next.from);
+    auto& to = items(**next.to);
+    // no reallocation from here on, pending entries point into to
+    to.reserve(from.size());
+    for (auto& item: from) {
+      auto& copy = to.emplace_back(std::move(item.paragraph_));
+      if (!item.nested_)
+        continue;
+      if (item.nested_.get_deleter().resource == allocator.resource())
+        copy.nested_ = std::move(item.nested_);
+      else
+        pending.push_back(pending_move{ item.nested_.get(), &copy.nested_ });
+    }
+  }
+  return moved;
+}
+
+
+template<typename List>
+fragment_ptr list_item::shell(List& list, allocator_type const& allocator) {
+  List empty{ list.header(), allocator };
+  empty.revision_ = list.revision_;
+  return make_fragment(std::move(empty), allocator);
+}
+
+
+inline list_item::list_item(class unordered_list unordered_list, allocator_type const& allocator):
+  paragraph_{ allocator }, nested_{ make_fragment(std::move(unordered_list), allocator) } { }
+
+
+inline list_item::list_item(class ordered_list ordered_list, allocator_type const& allocator):
+  paragraph_{ allocator }, nested_{ make_fragment(std::move(ordered_list), allocator) } { }
+
+
+// Nested lists deeper than one level are torn down from a heap stack,
+// so destroying a list thousands of levels deep doesn't recurse
+inline list_item::~list_item() {
+  if (!nested_)
+    return;
+  auto const nests = [](list_item const& item) { return bool(item.nested_); };
+  auto& children = items(*nested_);
+  if (std::none_of(children.begin(), children.end(), nests))
+    return;
+  std::vector<fragment_ptr> pending;
+  pending.push_back(std::move(nested_));
+  while (!pending.empty()) {
+    auto next = std::move(pending.back());
+    pending.pop_back();
+    for (auto& item: items(*next))
+      if (item.nested_)
+        pending.push_back(std::move(item.nested_));
+  }
+}
+
+
+inline std::pmr::vector<list_item>& list_item::items(fragment& nested) noexcept {
+  if (auto* list = nested.unordered_list())
+    return list->items_;
+  return nested.ordered_list()->items_;
+}
+
+
+inline unordered_list const* list_item::unordered_list() const noexcept {
+  return nested_ ? nested_->unordered_list() : nullptr;
+}
+
+
+inline ordered_list const* list_item::ordered_list() const noexcept {
+  return nested_ ? nested_->ordered_list() : nullptr;
+}
+
+
+inline fragment_kind list_item::kind() const noexcept {
+  return nested_ ? nested_->kind() : fragment_kind::paragraph;
+}
+
+
 inline unordered_list&& unordered_list::add(paragraph paragraph) {
-  items_.emplace_back(std::make_unique<fragment>(std::move(paragraph)));
+  items_.emplace_back(std::move(paragraph));
+  revision_ = detail::next_revision();
   return std::move(*this);
 }
 
 
 inline unordered_list&& unordered_list::add(unordered_list unordered_list) {
-  items_.emplace_back(std::make_unique<fragment>(std::move(unordered_list)));
+  items_.emplace_back(std::move(unordered_list));
+  revision_ = detail::next_revision();
   return std::move(*this);
 }
 
 
 inline unordered_list&& unordered_list::add(ordered_list ordered_list) {
-  items_.emplace_back(std::make_unique<fragment>(std::move(ordered_list)));
+  items_.emplace_back(std::move(ordered_list));
+  revision_ = detail::next_revision();
   return std::move(*this);
 }
 
 
 inline ordered_list&& ordered_list::add(paragraph paragraph) {
-  items_.emplace_back(std::make_unique<fragment>(std::move(paragraph)));
+  items_.emplace_back(std::move(paragraph));
+  revision_ = detail::next_revision();
   return std::move(*this);
 }
 
 
 inline ordered_list&& ordered_list::add(unordered_list unordered_list) {
-  items_.emplace_back(std::make_unique<fragment>(std::move(unordered_list)));
+  items_.emplace_back(std::move(unordered_list));
+  revision_ = detail::next_revision();
   return std::move(*this);
 }
 
 
 inline ordered_list&& ordered_list::add(ordered_list ordered_list) {
-  items_.emplace_back(std::make_unique<fragment>(std::move(ordered_list)));
+  items_.emplace_back(std::move(ordered_list));
+  revision_ = detail::next_revision();
   return std::move(*this);
 }
 
 
 class subsection {
 public:
-  using items_type = std::list<fragment>;
+  using items_type = std::pmr::vector<fragment>;
   using const_iterator = items_type::const_iterator;
+  using allocator_type = pmr::allocator_type;
 
-  subsection() = default;
+  subsection() noexcept: subsection{ pmr::allocator() } { }
+  explicit subsection(allocator_type const& allocator) noexcept:
+    header_{ allocator }, items_{ allocator }, ids_{ allocator } { }
   subsection(subsection const&) = delete;
   subsection& operator = (subsection const&) = delete;
-  subsection(subsection&&) = default;
-  subsection& operator = (subsection&&) = default;
-  explicit subsection(std::string header) noexcept: header_{std::move(header)} { }
+  subsection(subsection&& other) noexcept:
+    header_{ std::move(other.header_) }, items_{ std::move(other.items_) },
+    ids_{ std::move(other.ids_) }, revision_{ other.revision_ } {
+    other.forget();
+  }
+
+  subsection(subsection&& other, allocator_type const& allocator):
+    header_{ std::move(other.header_), allocator }, items_{ std::move(other.items_), allocator },
+    ids_{ std::move(other.ids_), allocator }, revision_{ other.revision_ } {
+    other.forget();
+  }
+
+  subsection& operator = (subsection&& other) {
+    header_ = std::move(other.header_);
+    items_ = std::move(other.items_);
+    ids_ = std::move(other.ids_);
+    revision_ = detail::next_revision();
+    other.forget();
+    return *this;
+  }
+
+  explicit subsection(std::string_view header, allocator_type const& allocator = pmr::allocator()):
+    header_{ header, allocator }, items_{ allocator }, ids_{ allocator } { }
   const_iterator begin() const noexcept { return items_.begin(); }
   const_iterator end() const noexcept { return items_.end(); }
-  std::string const& header() const noexcept { return header_; }
+  std::string_view header() const noexcept { return header_; }
+  allocator_type get_allocator() const noexcept { return items_.get_allocator(); }
+  items_type::size_type size() const noexcept { return items_.size(); }
+  fragment const& at(items_type::size_type i) const noexcept { return items_[i]; }
+  fragment& at(items_type::size_type i) noexcept { return items_[i]; }
+  std::uint64_t revision() const noexcept { return revision_; }
+
+  bool remove(items_type::size_type i) {
+    if (i >= items_.size())
+      return false;
+    items_.erase(items_.begin() + i);
+    ids_.erase(i);
+    revision_ = detail::next_revision();
+    return true;
+  }
+
+  // the item named by id, nullptr once it's removed
+  fragment const* find(node_id id) const noexcept {
+    auto const i = ids_.find(id.value);
+    return i != detail::item_ids::npos ? &items_[i] : nullptr;
+  }
+
+  fragment* find(node_id id) noexcept {
+    auto const i = ids_.find(id.value);
+    return i != detail::item_ids::npos ? &items_[i] : nullptr;
+  }
+
+  bool remove(node_id id) {
+    auto const i = ids_.find(id.value);
+    return i != detail::item_ids::npos && remove(i);
+  }
+
+  // adds like add(item) and names the item by id, a default id when skipped
+  template<typename T>
+  subsection&& add(T&& item, node_id& id) {
+    auto const size = items_.size();
+    add(std::forward<T>(item));
+    id = items_.size() != size ? node_id{ ids_.back() } : node_id{};
+    return std::move(*this);
+  }
   
   
   subsection&& add(paragraph paragraph) {
-    items_.emplace_back(fragment{ std::move(paragraph) });
-    return std::move(*this);
+    items_.emplace_back(std::move(paragraph));
+    return touch();
   }
   
   
   subsection&& add(table table) {
-    items_.emplace_back(fragment{std::move(table)});
-    return std::move(*this);
+    items_.emplace_back(std::move(table));
+    return touch();
+  }
+
+
+  subsection&& add(columnar_table columnar_table) {
+    items_.emplace_back(std::move(columnar_table));
+    return touch();
+  }
+
+
+  subsection&& add(lazy_table lazy_table) {
+    items_.emplace_back(std::move(lazy_table));
+    return touch();
   }
 
 
   subsection&& add(unordered_list unordered_list) {
-    items_.emplace_back(fragment{std::move(unordered_list)});
-    return std::move(*this);
+    items_.emplace_back(std::move(unordered_list));
+    return touch();
   }
 
 
   subsection&& add(ordered_list ordered_list) {
-    items_.emplace_back(fragment{std::move(ordered_list)});
-    return std::move(*this);
+    items_.emplace_back(std::move(ordered_list));
+    return touch();
   }
 
 private:
 
-  std::string header_;
+  pmr::string header_;
   items_type items_;
+  detail::item_ids ids_;
+  std::uint64_t revision_{ detail::next_revision() };
+
+
+  // a subsection moved from is left empty
+  void forget() noexcept {
+    header_.clear();
+    items_.clear();
+    ids_.clear();
+    revision_ = detail::next_revision();
+  }
+
+
+  // after an item is added
+  subsection&& touch() {
+    ids_.push();
+    revision_ = detail::next_revision();
+    return std::move(*this);
+  }
 };
 
 
@@ -402,23 +1990,48 @@ public:
 
   using item_type = std::variant<std::monostate, class paragraph, class table,
                                  class unordered_list, class ordered_list,
-                                 class subsection>;
+                                 class subsection, class columnar_table, class lazy_table>;
+  using allocator_type = pmr::allocator_type;
 
   subsection_or_fragment() = default;
   subsection_or_fragment(subsection_or_fragment const&) = delete;
   subsection_or_fragment& operator = (subsection_or_fragment const&) = delete;
   subsection_or_fragment(subsection_or_fragment&&) = default;
   subsection_or_fragment& operator = (subsection_or_fragment&&) = default;
-  explicit subsection_or_fragment(paragraph paragraph) noexcept: item_{std::move(paragraph)} { }
-  explicit subsection_or_fragment(table table) noexcept: item_{std::move(table)} { }
-  explicit subsection_or_fragment(unordered_list unordered_list) noexcept: item_{std::move(unordered_list)} { }
-  explicit subsection_or_fragment(ordered_list ordered_list) noexcept: item_{std::move(ordered_list)} { }
-  explicit subsection_or_fragment(subsection subsection) noexcept: item_{std::move(subsection)} { }
-  paragraph const* paragraph() const noexcept { return std::get_if<class paragraph>(&item_); }
-  table const* table() const noexcept { return std::get_if<class table>(&item_); }
-  unordered_list const* unordered_list() const noexcept { return std::get_if<class unordered_list>(&item_); }
-  ordered_list const* ordered_list() const noexcept { return std::get_if<class ordered_list>(&item_); }
-  subsection const* subsection() const noexcept { return std::get_if<class subsection>(&item_); }
+  subsection_or_fragment(subsection_or_fragment&& other, allocator_type const& allocator):
+    item_{ pmr::detail::rebind(std::move(other.item_), allocator) } { }
+  explicit subsection_or_fragment(class paragraph paragraph) noexcept: item_{std::move(paragraph)} { }
+  explicit subsection_or_fragment(class table table) noexcept: item_{std::move(table)} { }
+  explicit subsection_or_fragment(class columnar_table columnar_table) noexcept: item_{std::move(columnar_table)} { }
+  explicit subsection_or_fragment(class lazy_table lazy_table) noexcept: item_{std::move(lazy_table)} { }
+  explicit subsection_or_fragment(class unordered_list unordered_list) noexcept: item_{std::move(unordered_list)} { }
+  explicit subsection_or_fragment(class ordered_list ordered_list) noexcept: item_{std::move(ordered_list)} { }
+  explicit subsection_or_fragment(class subsection subsection) noexcept: item_{std::move(subsection)} { }
+  subsection_or_fragment(class paragraph paragraph, allocator_type const& allocator):
+    item_{ std::in_place_type<class paragraph>, std::move(paragraph), allocator } { }
+  subsection_or_fragment(class table table, allocator_type const& allocator):
+    item_{ std::in_place_type<class table>, std::move(table), allocator } { }
+  subsection_or_fragment(class columnar_table columnar_table, allocator_type const& allocator):
+    item_{ std::in_place_type<class columnar_table>, std::move(columnar_table), allocator } { }
+  subsection_or_fragment(class lazy_table lazy_table, allocator_type const& allocator):
+    item_{ std::in_place_type<class lazy_table>, std::move(lazy_table), allocator } { }
+  subsection_or_fragment(class unordered_list unordered_list, allocator_type const& allocator):
+    item_{ std::in_place_type<class unordered_list>, std::move(unordered_list), allocator } { }
+  subsection_or_fragment(class ordered_list ordered_list, allocator_type const& allocator):
+    item_{ std::in_place_type<class ordered_list>, std::move(ordered_list), allocator } { }
+  subsection_or_fragment(class subsection subsection, allocator_type const& allocator):
+    item_{ std::in_place_type<class subsection>, std::move(subsection), allocator } { }
+  class paragraph const* paragraph() const noexcept { return std::get_if<class paragraph>(&item_); }
+  class table const* table() const noexcept { return std::get_if<class table>(&item_); }
+  class columnar_table const* columnar_table() const noexcept { return std::get_if<class columnar_table>(&item_); }
+  class lazy_table const* lazy_table() const noexcept { return std::get_if<class lazy_table>(&item_); }
+  class unordered_list const* unordered_list() const noexcept { return std::get_if<class unordered_list>(&item_); }
+  class ordered_list const* ordered_list() const noexcept { return std::get_if<class ordered_list>(&item_); }
+  class subsection const* subsection() const noexcept { return std::get_if<class subsection>(&item_); }
+
+  class paragraph* paragraph() noexcept { return std::get_if<class paragraph>(&item_); }
+  class table* table() noexcept { return std::get_if<class table>(&item_); }
+  class subsection* subsection() noexcept { return std::get_if<class subsection>(&item_); }
 
   fragment_kind kind() const noexcept {
     switch(item_.index()) {
@@ -427,6 +2040,8 @@ public:
       case 3  : return fragment_kind::unordered_list;
       case 4  : return fragment_kind::ordered_list;
       case 5  : return fragment_kind::subsection;
+      case 6  : return fragment_kind::columnar_table;
+      case 7  : return fragment_kind::lazy_table;
       default : return fragment_kind::undefined;
     }
   }
@@ -439,53 +2054,146 @@ private:
 
 class section {
 public:
-  using items_type = std::list<subsection_or_fragment>;
+  using items_type = std::pmr::vector<subsection_or_fragment>;
   using const_iterator = items_type::const_iterator;
+  using allocator_type = pmr::allocator_type;
 
-  section() = default;
+  section() noexcept: section{ pmr::allocator() } { }
+  explicit section(allocator_type const& allocator) noexcept:
+    header_{ allocator }, items_{ allocator }, ids_{ allocator } { }
   section(section const&) = delete;
   section& operator = (section const&) = delete;
-  section(section&&) = default;
-  section& operator = (section&&) = default;
-  explicit section(std::string header) noexcept: header_{std::move(header)} { }
+  section(section&& other) noexcept:
+    header_{ std::move(other.header_) }, items_{ std::move(other.items_) },
+    ids_{ std::move(other.ids_) }, revision_{ other.revision_ } {
+    other.forget();
+  }
+
+  section(section&& other, allocator_type const& allocator):
+    header_{ std::move(other.header_), allocator }, items_{ std::move(other.items_), allocator },
+    ids_{ std::move(other.ids_), allocator }, revision_{ other.revision_ } {
+    other.forget();
+  }
+
+  section& operator = (section&& other) {
+    header_ = std::move(other.header_);
+    items_ = std::move(other.items_);
+    ids_ = std::move(other.ids_);
+    revision_ = detail::next_revision();
+    other.forget();
+    return *this;
+  }
+
+  explicit section(std::string_view header, allocator_type const& allocator = pmr::allocator()):
+    header_{ header, allocator }, items_{ allocator }, ids_{ allocator } { }
   const_iterator begin() const noexcept { return items_.begin(); }
   const_iterator end() const noexcept { return items_.end(); }
-  std::string const& header() const noexcept { return header_; }
+  std::string_view header() const noexcept { return header_; }
+  allocator_type get_allocator() const noexcept { return items_.get_allocator(); }
+  items_type::size_type size() const noexcept { return items_.size(); }
+  subsection_or_fragment const& at(items_type::size_type i) const noexcept { return items_[i]; }
+  subsection_or_fragment& at(items_type::size_type i) noexcept { return items_[i]; }
+  std::uint64_t revision() const noexcept { return revision_; }
+
+  bool remove(items_type::size_type i) {
+    if (i >= items_.size())
+      return false;
+    items_.erase(items_.begin() + i);
+    ids_.erase(i);
+    revision_ = detail::next_revision();
+    return true;
+  }
+
+  // the item named by id, nullptr once it's removed
+  subsection_or_fragment const* find(node_id id) const noexcept {
+    auto const i = ids_.find(id.value);
+    return i != detail::item_ids::npos ? &items_[i] : nullptr;
+  }
+
+  subsection_or_fragment* find(node_id id) noexcept {
+    auto const i = ids_.find(id.value);
+    return i != detail::item_ids::npos ? &items_[i] : nullptr;
+  }
+
+  bool remove(node_id id) {
+    auto const i = ids_.find(id.value);
+    return i != detail::item_ids::npos && remove(i);
+  }
+
+  // adds like add(item) and names the item by id, a default id when skipped
+  template<typename T>
+  section&& add(T&& item, node_id& id) {
+    auto const size = items_.size();
+    add(std::forward<T>(item));
+    id = items_.size() != size ? node_id{ ids_.back() } : node_id{};
+    return std::move(*this);
+  }
   
   section&& add(paragraph paragraph) {
-    items_.emplace_back(subsection_or_fragment{ std::move(paragraph) });
-    return std::move(*this);
+    items_.emplace_back(std::move(paragraph));
+    return touch();
   }
 
 
   section&& add(table table) {
-    items_.emplace_back(subsection_or_fragment{std::move(table)});
-    return std::move(*this);
+    items_.emplace_back(std::move(table));
+    return touch();
+  }
+
+
+  section&& add(columnar_table columnar_table) {
+    items_.emplace_back(std::move(columnar_table));
+    return touch();
+  }
+
+
+  section&& add(lazy_table lazy_table) {
+    items_.emplace_back(std::move(lazy_table));
+    return touch();
   }
 
 
   section&& add(unordered_list unordered_list) {
-    items_.emplace_back(subsection_or_fragment{std::move(unordered_list)});
-    return std::move(*this);
+    items_.emplace_back(std::move(unordered_list));
+    return touch();
   }
 
 
   section&& add(ordered_list ordered_list) {
-    items_.emplace_back(subsection_or_fragment{std::move(ordered_list)});
-    return std::move(*this);
+    items_.emplace_back(std::move(ordered_list));
+    return touch();
   }
 
 
   section&& add(subsection subsection) {
-    items_.emplace_back(subsection_or_fragment{std::move(subsection)});
-    return std::move(*this);
+    items_.emplace_back(std::move(subsection));
+    return touch();
   }
 
 
 private:
 
-  std::string header_;
+  pmr::string header_;
   items_type items_;
+  detail::item_ids ids_;
+  std::uint64_t revision_{ detail::next_revision() };
+
+
+  // a section moved from is left empty
+  void forget() noexcept {
+    header_.clear();
+    items_.clear();
+    ids_.clear();
+    revision_ = detail::next_revision();
+  }
+
+
+  // after an item is added
+  section&& touch() {
+    ids_.push();
+    revision_ = detail::next_revision();
+    return std::move(*this);
+  }
 };
 
 
@@ -494,25 +2202,67 @@ public:
 
   using item_type = std::variant<std::monostate, class paragraph,
                                  class table, class unordered_list, class ordered_list,
-                                 class subsection, class section>;
+                                 class subsection, class section, class columnar_table,
+                                 class lazy_table, std::shared_ptr<class section const>>;
+  using allocator_type = pmr::allocator_type;
 
   section_or_fragment() = default;
   section_or_fragment(section_or_fragment const&) = delete;
   section_or_fragment& operator = (section_or_fragment const&) = delete;
   section_or_fragment(section_or_fragment&&) = default;
   section_or_fragment& operator = (section_or_fragment&&) = default;
-  explicit section_or_fragment(paragraph paragraph) noexcept: item_{std::move(paragraph)} { }
-  explicit section_or_fragment(table table) noexcept: item_{std::move(table)} { }
-  explicit section_or_fragment(unordered_list unordered_list) noexcept: item_{std::move(unordered_list)} { }
-  explicit section_or_fragment(ordered_list ordered_list) noexcept: item_{std::move(ordered_list)} { }
-  explicit section_or_fragment(subsection subsection) noexcept: item_{std::move(subsection)} { }
-  explicit section_or_fragment(section section) noexcept: item_{std::move(section)} { }
-  paragraph const* paragraph() const noexcept { return std::get_if<class paragraph>(&item_); }
-  table const* table() const noexcept { return std::get_if<class table>(&item_); }
-  unordered_list const* unordered_list() const noexcept { return std::get_if<class unordered_list>(&item_); }
-  ordered_list const* ordered_list() const noexcept { return std::get_if<class ordered_list>(&item_); }
-  subsection const* subsection() const noexcept { return std::get_if<class subsection>(&item_); }
-  section const* section() const noexcept { return std::get_if<class section>(&item_); }
+  section_or_fragment(section_or_fragment&& other, allocator_type const& allocator):
+    item_{ pmr::detail::rebind(std::move(other.item_), allocator) } { }
+  explicit section_or_fragment(class paragraph paragraph) noexcept: item_{std::move(paragraph)} { }
+  explicit section_or_fragment(class table table) noexcept: item_{std::move(table)} { }
+  explicit section_or_fragment(class columnar_table columnar_table) noexcept: item_{std::move(columnar_table)} { }
+  explicit section_or_fragment(class lazy_table lazy_table) noexcept: item_{std::move(lazy_table)} { }
+  explicit section_or_fragment(class unordered_list unordered_list) noexcept: item_{std::move(unordered_list)} { }
+  explicit section_or_fragment(class ordered_list ordered_list) noexcept: item_{std::move(ordered_list)} { }
+  explicit section_or_fragment(class subsection subsection) noexcept: item_{std::move(subsection)} { }
+  explicit section_or_fragment(class section section) noexcept: item_{std::move(section)} { }
+  explicit section_or_fragment(std::shared_ptr<class section const> section) noexcept: item_{std::move(section)} { }
+  section_or_fragment(class paragraph paragraph, allocator_type const& allocator):
+    item_{ std::in_place_type<class paragraph>, std::move(paragraph), allocator } { }
+  section_or_fragment(class table table, allocator_type const& allocator):
+    item_{ std::in_place_type<class table>, std::move(table), allocator } { }
+  section_or_fragment(class columnar_table columnar_table, allocator_type const& allocator):
+    item_{ std::in_place_type<class columnar_table>, std::move(columnar_table), allocator } { }
+  section_or_fragment(class lazy_table lazy_table, allocator_type const& allocator):
+    item_{ std::in_place_type<class lazy_table>, std::move(lazy_table), allocator } { }
+  section_or_fragment(class unordered_list unordered_list, allocator_type const& allocator):
+    item_{ std::in_place_type<class unordered_list>, std::move(unordered_list), allocator } { }
+  section_or_fragment(class ordered_list ordered_list, allocator_type const& allocator):
+    item_{ std::in_place_type<class ordered_list>, std::move(ordered_list), allocator } { }
+  section_or_fragment(class subsection subsection, allocator_type const& allocator):
+    item_{ std::in_place_type<class subsection>, std::move(subsection), allocator } { }
+  section_or_fragment(class section section, allocator_type const& allocator):
+    item_{ std::in_place_type<class section>, std::move(section), allocator } { }
+  section_or_fragment(std::shared_ptr<class section const> section, allocator_type const&) noexcept:
+    item_{ std::move(section) } { }
+  class paragraph const* paragraph() const noexcept { return std::get_if<class paragraph>(&item_); }
+  class table const* table() const noexcept { return std::get_if<class table>(&item_); }
+  class columnar_table const* columnar_table() const noexcept { return std::get_if<class columnar_table>(&item_); }
+  class lazy_table const* lazy_table() const noexcept { return std::get_if<class lazy_table>(&item_); }
+  class unordered_list const* unordered_list() const noexcept { return std::get_if<class unordered_list>(&item_); }
+  class ordered_list const* ordered_list() const noexcept { return std::get_if<class ordered_list>(&item_); }
+  class subsection const* subsection() const noexcept { return std::get_if<class subsection>(&item_); }
+
+  class section const* section() const noexcept {
+    if (auto const* shared = shared_section())
+      return shared->get();
+    return std::get_if<class section>(&item_);
+  }
+
+  std::shared_ptr<class section const> const* shared_section() const noexcept {
+    return std::get_if<std::shared_ptr<class section const>>(&item_);
+  }
+
+  class paragraph* paragraph() noexcept { return std::get_if<class paragraph>(&item_); }
+  class table* table() noexcept { return std::get_if<class table>(&item_); }
+  class subsection* subsection() noexcept { return std::get_if<class subsection>(&item_); }
+  // shared sections stay immutable
+  class section* section() noexcept { return std::get_if<class section>(&item_); }
 
   fragment_kind kind() const noexcept {
     switch(item_.index()) {
@@ -522,6 +2272,9 @@ public:
       case 4  : return fragment_kind::ordered_list;
       case 5  : return fragment_kind::subsection;
       case 6  : return fragment_kind::section;
+      case 7  : return fragment_kind::columnar_table;
+      case 8  : return fragment_kind::lazy_table;
+      case 9  : return fragment_kind::section;
       default : return fragment_kind::undefined;
     }
   }
@@ -534,145 +2287,1720 @@ private:
 
 class document {
 public:
-  using items_type = std::list<section_or_fragment>;
+  using items_type = std::pmr::vector<section_or_fragment>;
   using const_iterator = items_type::const_iterator;
+  using allocator_type = pmr::allocator_type;
 
-  document() = default;
+  document() noexcept: document{ pmr::allocator() } { }
+  explicit document(allocator_type const& allocator) noexcept:
+    header_{ allocator }, items_{ allocator }, ids_{ allocator } { }
   document(document const&) = delete;
   document& operator = (document const&) = delete;
-  document(document&&) = default;
-  document& operator = (document&&) = default;
-  explicit document(std::string header) noexcept: header_{std::move(header)} { }
-  const_iterator begin() const noexcept { return items_.begin(); }
-  const_iterator end() const noexcept { return items_.end(); }
-  std::string const& header() const noexcept { return header_; }
-  
-  document&& add(paragraph paragraph) {
-    items_.emplace_back(section_or_fragment{ std::move(paragraph) });
-    return std::move(*this);
+  document(document&& other) noexcept:
+    header_{ std::move(other.header_) }, items_{ std::move(other.items_) },
+    ids_{ std::move(other.ids_) }, revision_{ other.revision_ } {
+    other.forget();
   }
 
+  document(document&& other, allocator_type const& allocator):
+    header_{ std::move(other.header_), allocator }, items_{ std::move(other.items_), allocator },
+    ids_{ std::move(other.ids_), allocator }, revision_{ other.revision_ } {
+    other.forget();
+  }
 
-  document&& add(table table) {
-    items_.emplace_back(section_or_fragment{std::move(table)});
-    return std::move(*this);
+  document& operator = (document&& other) {
+    header_ = std::move(other.header_);
+    items_ = std::move(other.items_);
+    ids_ = std::move(other.ids_);
+    revision_ = detail::next_revision();
+    other.forget();
+    return *this;
   }
 
+  explicit document(std::string_view header, allocator_type const& allocator = pmr::allocator()):
+    header_{ header, allocator }, items_{ allocator }, ids_{ allocator } { }
+  const_iterator begin() const noexcept { return items_.begin(); }
+  const_iterator end() const noexcept { return items_.end(); }
+  std::string_view header() const noexcept { return header_; }
+  allocator_type get_allocator() const noexcept { return items_.get_allocator(); }
+  items_type::size_type size() const noexcept { return items_.size(); }
+  std::uint64_t revision() const noexcept { return revision_; }
+
+  // Items here and in sections, subsections, texts and tables are addressed
+  // by position. Positions shift: remove() moves everything after the
+  // removed item down by one, and like references into a vector, those
+  // returned by at() are invalidated by add() and remove(). at() expects
+  // i < size(), the changes return false for a position past it. Items of
+  // documents, sections and subsections and rows of tables also have ids
+  // that add() hands out and that keep naming the same item until it's
+  // removed, find() and the changes take them too.
+  section_or_fragment const& at(items_type::size_type i) const noexcept { return items_[i]; }
+  section_or_fragment& at(items_type::size_type i) noexcept { return items_[i]; }
+
+  bool remove(items_type::size_type i) {
+    if (i >= items_.size())
+      return false;
+    items_.erase(items_.begin() + i);
+    ids_.erase(i);
+    revision_ = detail::next_revision();
+    return true;
+  }
 
-  document&& add(unordered_list unordered_list) {
-    items_.emplace_back(section_or_fragment{std::move(unordered_list)});
+  // the item named by id, nullptr once it's removed
+  section_or_fragment const* find(node_id id) const noexcept {
+    auto const i = ids_.find(id.value);
+    return i != detail::item_ids::npos ? &items_[i] : nullptr;
+  }
+
+  section_or_fragment* find(node_id id) noexcept {
+    auto const i = ids_.find(id.value);
+    return i != detail::item_ids::npos ? &items_[i] : nullptr;
+  }
+
+  bool remove(node_id id) {
+    auto const i = ids_.find(id.value);
+    return i != detail::item_ids::npos && remove(i);
+  }
+
+  // adds like add(item) and names the item by id, a default id when skipped
+  template<typename T>
+  document&& add(T&& item, node_id& id) {
+    auto const size = items_.size();
+    add(std::forward<T>(item));
+    id = items_.size() != size ? node_id{ ids_.back() } : node_id{};
     return std::move(*this);
   }
+  
+  document&& add(paragraph paragraph) {
+    items_.emplace_back(std::move(paragraph));
+    return touch();
+  }
+
+
+  document&& add(table table) {
+    items_.emplace_back(std::move(table));
+    return touch();
+  }
+
+
+  document&& add(columnar_table columnar_table) {
+    items_.emplace_back(std::move(columnar_table));
+    return touch();
+  }
+
+
+  document&& add(lazy_table lazy_table) {
+    items_.emplace_back(std::move(lazy_table));
+    return touch();
+  }
+
+
+  document&& add(unordered_list unordered_list) {
+    items_.emplace_back(std::move(unordered_list));
+    return touch();
+  }
 
 
   document&& add(ordered_list ordered_list) {
-    items_.emplace_back(section_or_fragment{std::move(ordered_list)});
-    return std::move(*this);
+    items_.emplace_back(std::move(ordered_list));
+    return touch();
   }
 
 
   document&& add(subsection subsection) {
-    items_.emplace_back(section_or_fragment{std::move(subsection)});
-    return std::move(*this);
+    items_.emplace_back(std::move(subsection));
+    return touch();
   }
 
 
   document&& add(section section) {
-    items_.emplace_back(section_or_fragment{std::move(section)});
-    return std::move(*this);
+    items_.emplace_back(std::move(section));
+    return touch();
+  }
+
+
+  // shared sections are only pointed at, one copy serves every document
+  document&& add(std::shared_ptr<section const> section) {
+    if (!section)
+      return std::move(*this);
+    items_.emplace_back(std::move(section));
+    return touch();
   }
 
 private:
 
-  std::string header_;
+  pmr::string header_;
   items_type items_;
+  detail::item_ids ids_;
+  std::uint64_t revision_{ detail::next_revision() };
+
+
+  // a document moved from is left empty
+  void forget() noexcept {
+    header_.clear();
+    items_.clear();
+    ids_.clear();
+    revision_ = detail::next_revision();
+  }
+
+
+  // after an item is added
+  document&& touch() {
+    ids_.push();
+    revision_ = detail::next_revision();
+    return std::move(*this);
+  }
+};
+
+
+enum class node_kind : std::uint8_t {
+  document, section, subsection, paragraph, table, table_header, table_row,
+  unordered_list, ordered_list, span
+};
+
+
+// Whole document in a few flat arrays, one entry per node, and a single
+// blob with the text of headers and spans. Children are linked through
+// first_child / next_sibling, so rendering walks the arrays in order.
+class flat_document {
+public:
+
+  using index_type = std::uint32_t;
+  using size_type = std::size_t;
+
+  static constexpr index_type none = std::numeric_limits<index_type>::max();
+  static constexpr index_type root = 0;
+
+  class builder;
+
+  flat_document() = default;
+  flat_document(flat_document const&) = default;
+  flat_document& operator = (flat_document const&) = default;
+  flat_document(flat_document&&) noexcept = default;
+  flat_document& operator = (flat_document&&) noexcept = default;
+
+  size_type size() const noexcept { return kinds_.size(); }
+  std::string_view blob() const noexcept { return blob_; }
+  std::string_view header() const noexcept { return empty() ? std::string_view{} : text(root); }
+  bool empty() const noexcept { return kinds_.empty(); }
+
+  node_kind kind(index_type i) const noexcept { return kinds_[i]; }
+  enum tag tag(index_type i) const noexcept { return tags_[i]; }
+  index_type parent(index_type i) const noexcept { return parents_[i]; }
+  index_type first_child(index_type i) const noexcept { return first_children_[i]; }
+  index_type next_sibling(index_type i) const noexcept { return next_siblings_[i]; }
+
+  // header of a container or text of a span
+  std::string_view text(index_type i) const noexcept {
+    return std::string_view{ blob_ }.substr(offsets_[i], lengths_[i]);
+  }
+
+private:
+
+  std::vector<node_kind> kinds_;
+  std::vector<enum tag> tags_;
+  std::vector<index_type> parents_;
+  std::vector<index_type> first_children_;
+  std::vector<index_type> next_siblings_;
+  std::vector<size_type> offsets_;
+  std::vector<index_type> lengths_;
+  std::string blob_;
+
+
+  index_type append(node_kind kind, enum tag tag, index_type parent, std::string_view text) {
+    index_type const i = index_type(kinds_.size());
+    kinds_.push_back(kind);
+    tags_.push_back(tag);
+    parents_.push_back(parent);
+    first_children_.push_back(none);
+    next_siblings_.push_back(none);
+    offsets_.push_back(blob_.size());
+    lengths_.push_back(index_type(text.size()));
+    blob_.append(text);
+    return i;
+  }
+
+
+  void truncate(index_type nodes, size_type blob) {
+    kinds_.resize(nodes);
+    tags_.resize(nodes);
+    parents_.resize(nodes);
+    first_children_.resize(nodes);
+    next_siblings_.resize(nodes);
+    offsets_.resize(nodes);
+    lengths_.resize(nodes);
+    blob_.resize(blob);
+  }
+};
+
+
+// Fills a flat_document the way the fluent add() calls build the tree:
+// opening a node nests it into the innermost open node that can hold it,
+// closing whatever can't, and end() closes the innermost node explicitly.
+// Calls that the tree types would not compile are ignored, and rows that
+// don't match the table header are dropped like table::add does.
+class flat_document::builder {
+public:
+
+  builder(): builder{ std::string_view{} } { }
+
+  explicit builder(std::string_view header) {
+    open_.push_back(entry{ document_.append(node_kind::document, tag::normal, none, header) });
+  }
+
+  builder(builder const&) = delete;
+  builder& operator = (builder const&) = delete;
+
+
+  builder& section(std::string_view header) {
+    return open(node_kind::section, header);
+  }
+
+
+  builder& subsection(std::string_view header) {
+    return open(node_kind::subsection, header);
+  }
+
+
+  builder& paragraph() {
+    return open(node_kind::paragraph, {});
+  }
+
+
+  builder& unordered_list(std::string_view header = {}) {
+    return open(node_kind::unordered_list, header);
+  }
+
+
+  builder& ordered_list(std::string_view header = {}) {
+    return open(node_kind::ordered_list, header);
+  }
+
+
+  builder& table(std::initializer_list<std::string_view> header) {
+    open(node_kind::table, {});
+    if (document_.kind(open_.back().node) != node_kind::table)
+      return *this;
+    open(node_kind::table_header, {});
+    for (auto const cell: header)
+      add(cell);
+    return close();
+  }
+
+
+  builder& row() {
+    return open(node_kind::table_row, {});
+  }
+
+
+  builder& add(std::string_view text) {
+    return add(tag::normal, text);
+  }
+
+
+  builder& add(enum tag tag, std::string_view text) {
+    auto const kind = document_.kind(open_.back().node);
+    if (kind != node_kind::paragraph && kind != node_kind::table_row && kind != node_kind::table_header)
+      return *this;
+    link(document_.append(node_kind::span, tag, open_.back().node, text));
+    return *this;
+  }
+
 
+  builder& end() {
+    if (open_.size() > 1)
+      close();
+    return *this;
+  }
+
+
+  // closes everything still open, the builder starts over afterwards
+  flat_document build() {
+    while (open_.size() > 1)
+      close();
+    flat_document built = std::move(document_);
+    document_ = flat_document{};
+    open_.clear();
+    open_.push_back(entry{ document_.append(node_kind::document, tag::normal, none, {}) });
+    return built;
+  }
+
+private:
+
+  struct entry {
+    index_type node;
+    index_type last_child{ none };
+    index_type previous{ none };
+    index_type children{ 0 };
+    size_type blob{ 0 };
+  };
+
+  flat_document document_;
+  std::vector<entry> open_;
+
+
+  static bool holds(node_kind parent, node_kind child) noexcept {
+    switch (child) {
+      case node_kind::section:
+        return parent == node_kind::document;
+      case node_kind::subsection:
+        return parent == node_kind::document || parent == node_kind::section;
+      case node_kind::table:
+        return parent == node_kind::document || parent == node_kind::section
+            || parent == node_kind::subsection;
+      case node_kind::paragraph:
+      case node_kind::unordered_list:
+      case node_kind::ordered_list:
+        return parent == node_kind::document || parent == node_kind::section
+            || parent == node_kind::subsection || parent == node_kind::unordered_list
+            || parent == node_kind::ordered_list;
+      case node_kind::table_header:
+      case node_kind::table_row:
+        return parent == node_kind::table;
+      default:
+        return false;
+    }
+  }
+
+
+  builder& open(node_kind kind, std::string_view header) {
+    auto i = open_.size();
+    while (i != 0 && !holds(document_.kind(open_[i - 1].node), kind))
+      --i;
+    if (i == 0)
+      return *this;
+    while (open_.size() != i)
+      close();
+    entry e{ document_.append(kind, tag::normal, open_.back().node, header) };
+    e.previous = open_.back().last_child;
+    e.blob = document_.offsets_[e.node];
+    link(e.node);
+    open_.push_back(e);
+    return *this;
+  }
+
+
+  void link(index_type i) {
+    auto& parent = open_.back();
+    if (parent.last_child == none)
+      document_.first_children_[parent.node] = i;
+    else
+      document_.next_siblings_[parent.last_child] = i;
+    parent.last_child = i;
+    ++parent.children;
+  }
+
+
+  builder& close() {
+    entry const e = open_.back();
+    open_.pop_back();
+    if (document_.kind(e.node) != node_kind::table_row)
+      return *this;
+    auto& table = open_.back();
+    index_type const header = document_.first_child(table.node);
+    index_type columns = 0;
+    for (auto j = document_.first_child(header); j != none; j = document_.next_sibling(j))
+      ++columns;
+    if (e.children == columns)
+      return *this;
+    // unlink and forget the row, it's the last thing appended
+    if (e.previous == none)
+      document_.first_children_[table.node] = none;
+    else
+      document_.next_siblings_[e.previous] = none;
+    table.last_child = e.previous;
+    --table.children;
+    document_.truncate(e.node, e.blob);
+    return *this;
+  }
+};
+
+
+class writer;
+class document_template;
+class live_output;
+
+
+namespace detail {
+
+struct placeholders {
+  class document document{ pmr::allocator_type{ std::pmr::new_delete_resource() } };
+  class section section{ pmr::allocator_type{ std::pmr::new_delete_resource() } };
+  class subsection subsection{ pmr::allocator_type{ std::pmr::new_delete_resource() } };
+  class paragraph paragraph{ pmr::allocator_type{ std::pmr::new_delete_resource() } };
+  class table table{ pmr::allocator_type{ std::pmr::new_delete_resource() } };
+  class table_row table_row{ pmr::allocator_type{ std::pmr::new_delete_resource() } };
+  class unordered_list unordered_list{ pmr::allocator_type{ std::pmr::new_delete_resource() } };
+  class ordered_list ordered_list{ pmr::allocator_type{ std::pmr::new_delete_resource() } };
+  class list_item list_item{ pmr::allocator_type{ std::pmr::new_delete_resource() } };
+
+  static placeholders const& get() noexcept {
+    static placeholders const instance;
+    return instance;
+  }
 };
 
 
-class formatter {
+// Threads kept between parallel renders. run() hands a job to n - 1 of
+// them, does the first share itself and returns once every share is done.
+class worker_pool {
+public:
+
+  worker_pool() = default;
+  worker_pool(worker_pool const&) = delete;
+  worker_pool& operator = (worker_pool const&) = delete;
+
+  ~worker_pool() {
+    {
+      std::lock_guard<std::mutex> const lock{ mutex_ };
+      stopping_ = true;
+    }
+    wake_.notify_all();
+    for (auto& thread: threads_)
+      thread.join();
+  }
+
+
+  // Calls job(w) for each w below the count returned, which is less than
+  // n when no more threads could be started. job must not throw.
+  template<typename Job>
+  std::size_t run(std::size_t n, Job const& job) {
+    while (threads_.size() + 1 < n) {
+      try {
+        threads_.emplace_back([this, w = threads_.size() + 1, seen = generation_] { loop(w, seen); });
+      } catch (...) {
+        n = threads_.size() + 1;
+      }
+    }
+    if (n > 1) {
+      {
+        std::lock_guard<std::mutex> const lock{ mutex_ };
+        call_ = [](void const* job, std::size_t w) { (*static_cast<Job const*>(job))(w); };
+        job_ = &job;
+        active_ = n;
+        busy_ = n - 1;
+        ++generation_;
+      }
+      wake_.notify_all();
+    }
+    job(0);
+    std::unique_lock<std::mutex> lock{ mutex_ };
+    done_.wait(lock, [this] { return busy_ == 0; });
+    return n;
+  }
+
+private:
+
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  std::condition_variable done_;
+  std::vector<std::thread> threads_;
+  void (*call_)(void const*, std::size_t){ nullptr };
+  void const* job_{ nullptr };
+  std::size_t generation_{ 0 };
+  std::size_t active_{ 0 };
+  std::size_t busy_{ 0 };
+  bool stopping_{ false };
+
+
+  // seen is the last job the thread knows of, threads started for a job
+  // are made before it's posted
+  void loop(std::size_t w, std::size_t seen) {
+    std::unique_lock<std::mutex> lock{ mutex_ };
+    for (;;) {
+      wake_.wait(lock, [&] { return stopping_ || generation_ != seen; });
+      if (stopping_)
+        return;
+      seen = generation_;
+      if (w >= active_)
+        continue;
+      auto const call = call_;
+      auto const* const job = job_;
+      lock.unlock();
+      call(job, w);
+      lock.lock();
+      if (--busy_ == 0)
+        done_.notify_one();
+    }
+  }
+};
+
+} // detail
+
+
+// Rendering with the hooks resolved at compile time: Derived provides the
+// on_* hooks it cares about and gets these empty ones for the rest, so a
+// formatter that knows its hooks pays no indirect call per cell. Hooks of
+// Derived are either public or protected with basic_formatter a friend.
+template<typename Derived>
+class basic_formatter {
 public:
 
   using string_type = uformat::continuous_texter::string_type;
   using size_type = uformat::continuous_texter::size_type;
+  using column_widths = std::vector<size_type>;
+
+  basic_formatter() = default;
+  explicit basic_formatter(uformat::pages pages) noexcept: texter_{string_type{pages}} { }
 
   string_type const& string() const noexcept { return texter_.string(); }
   char const* data() const noexcept { return texter_.data(); }
   size_type size() const noexcept { return texter_.size(); }
+  size_type high_water() const noexcept { return high_water_; }
+
+  // clear() decommits the buffer once it has grown past this many bytes
+  Derived& high_water(size_type bytes) noexcept {
+    high_water_ = bytes;
+    return derived();
+  }
 
 
+  // rewinds the output, committed pages stay resident for the next render
+  void clear() noexcept {
+    texter_.clear();
+    texter_.shrink_to(high_water_);
+    render_stats_ = render_statistics{};
+  }
+
+
+  // what the renders since the last clear() cost in memory
+  struct render_statistics {
+    // times the output committed more pages
+    size_type commits{ 0 };
+    // page faults of the rendering threads, see uformat::page_faults
+    size_type faults{ 0 };
+  };
+
+  render_statistics const& render_stats() const noexcept { return render_stats_; }
+
+
+  bool cache_shared() const noexcept { return cache_shared_; }
+
+  // Keep the rendered bytes of shared sections and copy them on their
+  // next use, in this document or any other holding the same section.
+  // Leave it off if a formatter's output for a section depends on the
+  // document around it. Entries of sections that are gone are dropped
+  // whenever the number of entries doubles.
+  Derived& cache_shared(bool enabled) {
+    cache_shared_ = enabled;
+    if (!enabled) {
+      shared_.clear();
+      shared_sweep_ = min_shared_sweep;
+    }
+    return derived();
+  }
+
+  size_type shared_entries() const noexcept { return shared_.size(); }
+
+
+  struct cache_statistics {
+    size_type hits{ 0 };
+    size_type misses{ 0 };
+    size_type evictions{ 0 };
+    size_type entries{ 0 };
+    size_type bytes{ 0 };
+  };
+
+  size_type cache_budget() const noexcept { return cache_budget_; }
+  cache_statistics const& cache_stats() const noexcept { return cache_stats_; }
+
+  // Keeps the rendered bytes of sections, subsections and tables by the
+  // fingerprint of their content, up to budget bytes with the least
+  // recently used dropped first. Zero turns the cache off and empties it.
+  // A hit is copied without calling the node's hooks, so equal content
+  // has to render to equal bytes wherever it appears. Columnar and lazy
+  // tables and borrowed spans, whose data can change without the node
+  // knowing, aren't fingerprinted, nor is anything holding one.
+  Derived& cache_budget(size_type bytes) {
+    cache_budget_ = bytes;
+    while (cache_stats_.bytes > cache_budget_)
+      evict();
+    return derived();
+  }
+
+
+  // with uformat::pages::memfd, hands the rendered output over as a sealed
+  // file descriptor (see continuous_string::seal) and starts a new one
+  int seal() noexcept { return texter_.string().seal(); }
+
 
   void render(document const& document) {
 
-    on_document_begin(document);
+    measure const measured{ *this };
+    derived().on_document_begin(document);
 
     if(!document.header().empty()) {
-      on_document_header(document.header());
+      derived().on_document_header(document.header());
     }        
 
     for(auto const& section_or_fragment: document)
-      switch(section_or_fragment.kind()) {
+      render(section_or_fragment);
+
+    derived().on_document_end(document);
+  }
+
+
+  // Top-level sections and fragments render on up to threads threads, each
+  // into a formatter of its own, and the outputs are appended in document
+  // order. Worker formatters are made by make() when first needed and kept
+  // with their threads for the next call, so rendering one document after
+  // another starts no threads once warm. With fewer threads available the
+  // ones there take the whole document, with none it renders serially.
+  // Every worker also sees the document hooks. A worker starts its share
+  // of items without having seen the ones before, so anything carried
+  // from one top-level item into the next, a running number say, comes
+  // out differently than with render(document).
+  template<typename Make>
+  void render(document const& document, std::size_t threads, Make&& make) {
+    size_type const count = document.size();
+    if (threads > count)
+      threads = count;
+    if (threads <= 1) {
+      render(document);
+      return;
+    }
+
+    struct part {
+      size_type worker;
+      size_type offset;
+      size_type size;
+    };
+
+    while (workers_.size() < threads)
+      workers_.push_back(make());
+    if (!pool_)
+      pool_ = std::make_unique<detail::worker_pool>();
+    std::vector<part> parts(count);
+    std::vector<std::exception_ptr> errors(threads);
+    std::atomic<size_type> next{ 0 };
+
+    auto const work = [&](std::size_t w) {
+      basic_formatter& worker = *workers_[w];
+      worker.clear();
+      measure const measured{ worker };
+      try {
+        worker.derived().on_document_begin(document);
+        if (!document.header().empty())
+          worker.derived().on_document_header(document.header());
+        // idle workers take the next item, so uneven sections even out
+        for (size_type i; (i = next.fetch_add(1, std::memory_order_relaxed)) < count;) {
+          size_type const begin = worker.texter_.size();
+          worker.render(document.at(i));
+          parts[i] = part{ w, begin, worker.texter_.size() - begin };
+        }
+        worker.derived().on_document_end(document);
+      } catch (...) {
+        errors[w] = std::current_exception();
+        next.store(count);
+      }
+    };
+
+    // workers past the ones the pool could start didn't run, nor clear()
+    auto const ran = pool_->run(threads, work);
+    for (size_type w = 0; w != ran; ++w)
+      if (errors[w])
+        std::rethrow_exception(errors[w]);
+
+    // workers counted their own faults, this thread's start from here
+    measure const measured{ *this };
+    for (size_type w = 0; w != ran; ++w) {
+      render_stats_.commits += workers_[w]->render_stats_.commits;
+      render_stats_.faults += workers_[w]->render_stats_.faults;
+    }
+    derived().on_document_begin(document);
+    if (!document.header().empty())
+      derived().on_document_header(document.header());
+    for (auto const& part: parts) {
+      basic_formatter const& worker = *workers_[part.worker];
+      texter_.append(worker.texter_.data() + part.offset, part.size);
+    }
+    derived().on_document_end(document);
+  }
+
+
+  // Hooks get the same calls as for the equivalent tree. Structural
+  // begin/end hooks receive empty placeholders, on_flat_node_begin/end
+  // around them tell which node it is, the content comes through header,
+  // text, cell and column hooks.
+  void render(flat_document const& document) {
+    if (document.empty())
+      return;
+
+    measure const measured{ *this };
+    auto const& empty = detail::placeholders::get();
+    derived().on_flat_node_begin(document, flat_document::root);
+    derived().on_document_begin(empty.document);
+
+    if (!document.header().empty())
+      derived().on_document_header(document.header());
+
+    for (auto i = document.first_child(flat_document::root); i != flat_document::none;
+         i = document.next_sibling(i))
+      render(document, i);
+
+    derived().on_document_end(empty.document);
+    derived().on_flat_node_end(document, flat_document::root);
+  }
+
+
+  bool write(std::string const& filename, std::error_code& ec) const noexcept {
+
+    FILE* file = fopen(filename.data(), "wb+");
+    if (file == nullptr) {
+      ec = std::make_error_code(std::errc(errno));
+      return false;
+    }
+
+    auto const written = fwrite(texter_.data(), sizeof(char), texter_.size(), file);
+    fclose(file);
+
+    if (written != texter_.size()) {
+      ec = std::make_error_code(std::errc(errno));
+      return false;
+    }
+    
+    return true;
+  }
+
+
+protected:
+
+  uformat::continuous_texter& texter() noexcept { return texter_; }
+
+  void on_document_begin(document const&) { }
+  void on_document_end(document const&) { }
+  void on_document_header(std::string_view) { }
+  void on_text(text const&) { }
+  void on_paragraph_begin(paragraph const&) { }
+  void on_paragraph_end(paragraph const&) { }
+  void on_table_begin(table const&) { }
+  void on_table_end(table const&) { }
+  // widest text in each column, header included, right after on_table_begin
+  void on_table_columns(column_widths const&) { }
+  void on_table_header_begin(table_header const&) { }
+  void on_table_header_end(table_header const&) { }
+  void on_table_header_cell(std::size_t, std::string_view) { }
+  void on_table_row_begin(table_row const&) { }
+  void on_table_row_end(table_row const&) { }
+  void on_table_cell_begin(std::size_t, span const&) { }
+  void on_table_cell_end(std::size_t, span const&) { }
+  void on_table_cell_text(std::size_t, span const&) { }
+  void on_subsection_begin(subsection const&) { }
+  void on_subsection_end(subsection const&) { }
+  void on_subsection_header(std::string_view) { }
+  void on_section_begin(section const&) { }
+  void on_section_end(section const&) { }
+  void on_section_header(std::string_view) { }
+  void on_unordered_list_begin(unordered_list const&) { }
+  void on_unordered_list_end(unordered_list const&) { }
+  void on_unordered_list_header(std::string_view) { }
+  void on_unordered_list_item_begin(list_item const&) { }
+  void on_unordered_list_item_end(list_item const&) { }
+  void on_ordered_list_begin(ordered_list const&) { }
+  void on_ordered_list_end(ordered_list const&) { }
+  void on_ordered_list_header(std::string_view) { }
+  void on_ordered_list_item_begin(std::size_t, list_item const&) { }
+  void on_ordered_list_item_end(std::size_t, list_item const&) { }
+
+  // Flat documents, columnar and lazy tables and the writer have no tree
+  // nodes, so their structural begin/end hooks get empty placeholders. The
+  // hooks below bracket those calls with what there is instead: the flat
+  // node, the table itself, or for the writer the kind of node.
+  void on_flat_node_begin(flat_document const&, flat_document::index_type) { }
+  void on_flat_node_end(flat_document const&, flat_document::index_type) { }
+  void on_columnar_table_begin(columnar_table const&) { }
+  void on_columnar_table_end(columnar_table const&) { }
+  void on_lazy_table_begin(lazy_table const&) { }
+  void on_lazy_table_end(lazy_table const&) { }
+  void on_stream_node_begin(node_kind) { }
+  void on_stream_node_end(node_kind) { }
+
+private:
+
+  friend class writer;
+  friend class document_template;
+  friend class live_output;
+
+  Derived& derived() noexcept { return static_cast<Derived&>(*this); }
+
+
+  // adds the commits and faults of the outermost render on this thread
+  class measure {
+  public:
+
+    explicit measure(basic_formatter& formatter) noexcept:
+      formatter_{ formatter }, outer_{ formatter.measuring_++ == 0 } {
+      if (!outer_)
+        return;
+      commits_ = formatter_.texter_.string().commits();
+      faults_ = uformat::page_faults();
+    }
+
+    ~measure() {
+      --formatter_.measuring_;
+      if (!outer_)
+        return;
+      auto& stats = formatter_.render_stats_;
+      // a sealed output starts a string with its own count
+      auto const commits = formatter_.texter_.string().commits();
+      stats.commits += commits >= commits_ ? commits - commits_ : commits;
+      stats.faults += size_type(uformat::page_faults() - faults_);
+    }
+
+    measure(measure const&) = delete;
+    measure& operator = (measure const&) = delete;
+
+  private:
+
+    basic_formatter& formatter_;
+    bool outer_;
+    size_type commits_{ 0 };
+    std::uint64_t faults_{ 0 };
+  };
+
+
+  uformat::continuous_texter texter_;
+  size_type high_water_{ std::numeric_limits<size_type>::max() };
+  render_statistics render_stats_;
+  unsigned measuring_{ 0 };
+  column_widths columns_;
+  class text text_{ pmr::allocator_type{ std::pmr::new_delete_resource() } };
+  std::pmr::vector<class table_row> rows_{ std::pmr::new_delete_resource() };
+
+  struct list_frame {
+    class unordered_list const* unordered{ nullptr };
+    class ordered_list const* ordered{ nullptr };
+    unordered_list::const_iterator item;
+    unordered_list::const_iterator end;
+    std::size_t number{ 1 };
+  };
+
+  std::vector<list_frame> lists_;
+
+  struct flat_list_frame {
+    flat_document::index_type list;
+    flat_document::index_type item;
+    std::size_t number{ 1 };
+  };
+
+  std::vector<flat_list_frame> flat_lists_;
+
+  struct shared_output {
+    std::weak_ptr<class section const> section;
+    std::string bytes;
+  };
+
+  static constexpr size_type min_shared_sweep = 16;
+
+  bool cache_shared_{ false };
+  std::unordered_map<class section const*, shared_output> shared_;
+  // the number of entries at which expired ones are swept
+  size_type shared_sweep_{ min_shared_sweep };
+  // set while a template compiles or renders
+  class document_template* template_{ nullptr };
+
+  // What a node is besides its key, compared before a hit is replayed so
+  // that keys colliding for different nodes don't swap their bytes
+  struct cache_check {
+    fragment_kind kind{ fragment_kind::undefined };
+    // rows of a table, items of a section or subsection
+    size_type items{ 0 };
+    size_type columns{ 0 };
+    std::string header;
+
+    bool matches(fragment_kind k, size_type n, size_type c, std::string_view h) const noexcept {
+      return kind == k && items == n && columns == c && header == h;
+    }
+  };
+
+  struct cached_output {
+    std::string bytes;
+    std::list<std::uint64_t>::iterator age;
+    cache_check check;
+  };
+
+  size_type cache_budget_{ 0 };
+  cache_statistics cache_stats_;
+  std::unordered_map<std::uint64_t, cached_output> cache_;
+  // most recently used first
+  std::list<std::uint64_t> ages_;
+  // the node being rendered for the cache, it doesn't look itself up
+  void const* storing_{ nullptr };
+
+  struct list_hash {
+    unordered_list::const_iterator item;
+    unordered_list::const_iterator end;
+    std::uint64_t hash;
+  };
+
+  std::vector<list_hash> list_hashes_;
+
+  std::vector<std::unique_ptr<Derived>> workers_;
+  std::unique_ptr<detail::worker_pool> pool_;
+
+  void render_text(class text const& text);
+  span const& resolve(span const& cell) const noexcept;
+  bool deferred(class table const& table);
+
+
+  void render(std::shared_ptr<class section const> const& section) {
+    if (!cache_shared_ || template_ != nullptr) {
+      render(*section);
+      return;
+    }
+    if (shared_.size() >= shared_sweep_ && shared_.find(section.get()) == shared_.end())
+      sweep_shared();
+    auto& cached = shared_[section.get()];
+    // the address may belong to a section that's gone
+    if (cached.section.lock() == section) {
+      texter_.append(cached.bytes.data(), cached.bytes.size());
+      return;
+    }
+    size_type const begin = texter_.size();
+    render(*section);
+    cached.section = section;
+    cached.bytes.assign(texter_.data() + begin, texter_.size() - begin);
+  }
+
+
+  void sweep_shared() {
+    for (auto it = shared_.begin(); it != shared_.end();) {
+      if (it->second.section.expired())
+        it = shared_.erase(it);
+      else
+        ++it;
+    }
+    shared_sweep_ = std::max(min_shared_sweep, shared_.size() * 2);
+  }
+
+
+  // Replays a node from the cache or renders and keeps it, false when
+  // there is nothing to do with the cache
+  template<typename Node>
+  bool render_cached(Node const& node) {
+    std::uint64_t key;
+    if (cache_budget_ == 0 || template_ != nullptr || storing_ == &node || !fingerprint(node, key))
+      return false;
+
+    auto const found = cache_.find(key);
+    if (found != cache_.end() && matches(found->second.check, node)) {
+      ++cache_stats_.hits;
+      ages_.splice(ages_.begin(), ages_, found->second.age);
+      texter_.append(found->second.bytes.data(), found->second.bytes.size());
+      return true;
+    }
+
+    ++cache_stats_.misses;
+    size_type const begin = texter_.size();
+    void const* const outer = storing_;
+    storing_ = &node;
+    render(node);
+    storing_ = outer;
+
+    size_type const size = texter_.size() - begin;
+    if (size > cache_budget_ || cache_.count(key) != 0)
+      return true;
+    while (cache_stats_.bytes + size > cache_budget_)
+      evict();
+    ages_.push_front(key);
+    cache_.emplace(key, cached_output{ std::string{ texter_.data() + begin, size }, ages_.begin(),
+                                       check(node) });
+    ++cache_stats_.entries;
+    cache_stats_.bytes += size;
+    return true;
+  }
+
+
+  static cache_check check(table const& table) {
+    return cache_check{ fragment_kind::table, table.rows_count(), table.columns_count(), {} };
+  }
+
+  static cache_check check(subsection const& subsection) {
+    return cache_check{ fragment_kind::subsection, subsection.size(), 0, std::string{ subsection.header() } };
+  }
+
+  static cache_check check(section const& section) {
+    return cache_check{ fragment_kind::section, section.size(), 0, std::string{ section.header() } };
+  }
+
+  static bool matches(cache_check const& c, table const& table) noexcept {
+    return c.matches(fragment_kind::table, table.rows_count(), table.columns_count(), {});
+  }
+
+  static bool matches(cache_check const& c, subsection const& subsection) noexcept {
+    return c.matches(fragment_kind::subsection, subsection.size(), 0, subsection.header());
+  }
+
+  static bool matches(cache_check const& c, section const& section) noexcept {
+    return c.matches(fragment_kind::section, section.size(), 0, section.header());
+  }
+
+
+  void evict() {
+    auto const found = cache_.find(ages_.back());
+    cache_stats_.bytes -= found->second.bytes.size();
+    --cache_stats_.entries;
+    ++cache_stats_.evictions;
+    cache_.erase(found);
+    ages_.pop_back();
+  }
+
+
+  // kinds are mixed in so equal content of different nodes doesn't collide
+  static std::uint64_t seed(fragment_kind kind, std::string_view header) noexcept {
+    auto const k = std::uint8_t(kind);
+    return detail::hash(detail::hash(detail::hash_seed, &k, sizeof(k)), header);
+  }
+
+
+  // false for borrowed text, it may read differently by the next render
+  bool fingerprint(table const& table, std::uint64_t& hash) noexcept {
+    if (table.borrows())
+      return false;
+    hash = detail::combine(seed(fragment_kind::table, {}), table.fingerprint());
+    return true;
+  }
+
+
+  // nested lists are folded with a stack of their own, as they're rendered
+  bool fingerprint(unordered_list::const_iterator begin, unordered_list::const_iterator end,
+                   std::uint64_t& hash) {
+    size_type const base = list_hashes_.size();
+    list_hashes_.push_back(list_hash{ begin, end, hash });
+    std::uint64_t folded = hash;
+    while (list_hashes_.size() != base) {
+      auto& frame = list_hashes_.back();
+      if (frame.item == frame.end) {
+        folded = frame.hash;
+        list_hashes_.pop_back();
+        if (list_hashes_.size() != base) {
+          auto& parent = list_hashes_.back();
+          parent.hash = detail::combine(parent.hash, folded);
+          ++parent.item;
+        }
+        continue;
+      }
+      auto const& item = *frame.item;
+      if (auto const* list = item.unordered_list())
+        list_hashes_.push_back(list_hash{ list->begin(), list->end(),
+                                          seed(fragment_kind::unordered_list, list->header()) });
+      else if (auto const* list = item.ordered_list())
+        list_hashes_.push_back(list_hash{ list->begin(), list->end(),
+                                          seed(fragment_kind::ordered_list, list->header()) });
+      else {
+        auto const& text = item.paragraph()->text();
+        if (text.borrows()) {
+          list_hashes_.resize(base);
+          return false;
+        }
+        frame.hash = detail::combine(frame.hash, text.fingerprint());
+        ++frame.item;
+      }
+    }
+    hash = folded;
+    return true;
+  }
+
+
+  template<typename Item>
+  bool fold(Item const& item, std::uint64_t& hash) {
+    std::uint64_t h;
+    switch (item.kind()) {
+      case fragment_kind::paragraph:
+        if (item.paragraph()->text().borrows())
+          return false;
+        h = detail::combine(seed(fragment_kind::paragraph, {}), item.paragraph()->text().fingerprint());
+        break;
+      case fragment_kind::table:
+        if (!fingerprint(*item.table(), h))
+          return false;
+        break;
+      case fragment_kind::unordered_list: {
+        auto const& list = *item.unordered_list();
+        h = seed(fragment_kind::unordered_list, list.header());
+        if (!fingerprint(list.begin(), list.end(), h))
+          return false;
+        break;
+      }
+      case fragment_kind::ordered_list: {
+        auto const& list = *item.ordered_list();
+        h = seed(fragment_kind::ordered_list, list.header());
+        if (!fingerprint(list.begin(), list.end(), h))
+          return false;
+        break;
+      }
+      default:
+        return false;
+    }
+    hash = detail::combine(hash, h);
+    return true;
+  }
+
+
+  bool fingerprint(subsection const& subsection, std::uint64_t& hash) {
+    hash = seed(fragment_kind::subsection, subsection.header());
+    for (auto const& fragment: subsection)
+      if (!fold(fragment, hash))
+        return false;
+    return true;
+  }
+
+
+  bool fingerprint(section const& section, std::uint64_t& hash) {
+    hash = seed(fragment_kind::section, section.header());
+    for (auto const& item: section) {
+      if (item.kind() != fragment_kind::subsection) {
+        if (!fold(item, hash))
+          return false;
+        continue;
+      }
+      std::uint64_t h;
+      if (!fingerprint(*item.subsection(), h))
+        return false;
+      hash = detail::combine(hash, h);
+    }
+    return true;
+  }
+
+
+  void render(section_or_fragment const& section_or_fragment) {
+    switch(section_or_fragment.kind()) {
+      case fragment_kind::paragraph:
+        render(*section_or_fragment.paragraph());
+        return;
+      case fragment_kind::table:
+        render(*section_or_fragment.table());
+        return;
+      case fragment_kind::columnar_table:
+        render(*section_or_fragment.columnar_table());
+        return;
+      case fragment_kind::lazy_table:
+        render(*section_or_fragment.lazy_table());
+        return;
+      case fragment_kind::unordered_list:
+        render(*section_or_fragment.unordered_list());
+        return;
+      case fragment_kind::ordered_list:
+        render(*section_or_fragment.ordered_list());
+        return;
+      case fragment_kind::subsection:
+        render(*section_or_fragment.subsection());
+        return;
+      case fragment_kind::section:
+        if (auto const* shared = section_or_fragment.shared_section())
+          render(*shared);
+        else
+          render(*section_or_fragment.section());
+        return;
+      default:
+        return;
+    }
+  }
+
+
+  void render(paragraph const& paragraph) {
+    derived().on_paragraph_begin(paragraph);
+    render_text(paragraph.text());
+    derived().on_paragraph_end(paragraph);
+  }
+
+
+  void render(table const& table) {
+    if (template_ != nullptr && deferred(table))
+      return;
+    if (render_cached(table))
+      return;
+    derived().on_table_begin(table);
+
+    columns_.resize(table.columns_count());
+    for (size_type i = 0; i != table.columns_count(); ++i)
+      columns_[i] = table.header()[i].size();
+    for (auto const& row: table)
+      for (size_type i = 0; i != row.size(); ++i) {
+        size_type const length = resolve(row.at(i)).length();
+        if (length > columns_[i])
+          columns_[i] = length;
+      }
+    render(table.header());
+
+    for(auto const& row: table)
+      render(row);
+
+    derived().on_table_end(table);
+  }
+
+
+  // column widths are in columns_ by now
+  void render(table_header const& header) {
+    derived().on_table_columns(columns_);
+
+    if (header.empty())
+      return;
+    derived().on_table_header_begin(header);
+    for (std::size_t i = 0; i != header.size(); ++i)
+      derived().on_table_header_cell(i, header[i]);
+    derived().on_table_header_end(header);
+  }
+
+
+  void render(table_row const& row) {
+    derived().on_table_row_begin(row);
+
+    std::size_t i = 0;
+    for(auto const& item: row) {
+      auto const& cell = resolve(item);
+      derived().on_table_cell_begin(i, cell);
+      derived().on_table_cell_text(i, cell);
+      derived().on_table_cell_end(i, cell);
+      ++i;
+    }
+
+    derived().on_table_row_end(row);
+  }
+
+
+  void render(lazy_table const& table) {
+    auto const& empty = detail::placeholders::get();
+    derived().on_lazy_table_begin(table);
+    derived().on_table_begin(empty.table);
+
+    size_type const columns = table.columns_count();
+    size_type sampled = 0;
+    bool exhausted = false;
+    auto const generator = table.rows();
+    auto const next = [&generator](table_row& row) {
+      row.clear();
+      return generator && generator(row);
+    };
+    if (table.widths().size() == columns) {
+      columns_ = table.widths();
+      for (size_type i = 0; i != columns; ++i)
+        columns_[i] = std::max(columns_[i], table.header()[i].size());
+    } else {
+      columns_.resize(columns);
+      for (size_type i = 0; i != columns; ++i)
+        columns_[i] = table.header()[i].size();
+      // rows of the sample are kept between renders to reuse their memory
+      while (sampled != table.sample_size()) {
+        if (rows_.size() == sampled)
+          rows_.emplace_back();
+        auto& row = rows_[sampled];
+        if (!next(row)) {
+          exhausted = true;
+          break;
+        }
+        if (row.size() != columns)
+          continue;
+        // the generator may point the next row into the same buffer
+        row.own();
+        for (size_type i = 0; i != columns; ++i)
+          if (row.at(i).length() > columns_[i])
+            columns_[i] = row.at(i).length();
+        ++sampled;
+      }
+    }
+    render(table.header());
+
+    for (size_type i = 0; i != sampled; ++i)
+      render(rows_[i]);
+    if (!exhausted) {
+      if (rows_.empty())
+        rows_.emplace_back();
+      auto& row = rows_[0];
+      while (next(row))
+        if (row.size() == columns)
+          render(row);
+    }
+
+    derived().on_table_end(empty.table);
+    derived().on_lazy_table_end(table);
+  }
+
+
+  void render(columnar_table const& table) {
+    auto const& empty = detail::placeholders::get();
+    derived().on_columnar_table_begin(table);
+    derived().on_table_begin(empty.table);
+
+    columns_.resize(table.columns_count());
+    for (size_type i = 0; i != table.columns_count(); ++i)
+      columns_[i] = std::max(table.header()[i].size(), table.at(i).stats().width);
+    render(table.header());
+
+    for (size_type row = 0; row != table.rows_count(); ++row) {
+      derived().on_table_row_begin(empty.table_row);
+      std::size_t i = 0;
+      for (auto const& column: table) {
+        auto const cell = column.cell(row);
+        derived().on_table_cell_begin(i, cell);
+        derived().on_table_cell_text(i, cell);
+        derived().on_table_cell_end(i, cell);
+        ++i;
+      }
+      derived().on_table_row_end(empty.table_row);
+    }
+
+    derived().on_table_end(empty.table);
+    derived().on_columnar_table_end(table);
+  }
+
+
+  void render(unordered_list const& unordered_list) {
+    render_lists(list_frame{ &unordered_list, nullptr, unordered_list.begin(), unordered_list.end() });
+  }
+
+
+  void render(ordered_list const& ordered_list) {
+    render_lists(list_frame{ nullptr, &ordered_list, ordered_list.begin(), ordered_list.end() });
+  }
+
+
+  // Nested lists are walked with lists_ as the stack instead of recursion,
+  // hooks come in the same order and depth is only bounded by memory
+  void render_lists(list_frame top) {
+    size_type const base = lists_.size();
+    open_list(top);
+    lists_.push_back(top);
+
+    while (lists_.size() != base) {
+      auto& frame = lists_.back();
+      if (frame.item == frame.end) {
+        if (frame.unordered != nullptr)
+          derived().on_unordered_list_end(*frame.unordered);
+        else
+          derived().on_ordered_list_end(*frame.ordered);
+        lists_.pop_back();
+        if (lists_.size() != base)
+          close_item(lists_.back());
+        continue;
+      }
+
+      auto const& item = *frame.item;
+      if (frame.unordered != nullptr)
+        derived().on_unordered_list_item_begin(item);
+      else
+        derived().on_ordered_list_item_begin(frame.number, item);
+
+      list_frame nested;
+      switch (item.kind()) {
+        case fragment_kind::unordered_list:
+          nested = list_frame{ item.unordered_list(), nullptr,
+                               item.unordered_list()->begin(), item.unordered_list()->end() };
+          break;
+        case fragment_kind::ordered_list:
+          nested = list_frame{ nullptr, item.ordered_list(),
+                               item.ordered_list()->begin(), item.ordered_list()->end() };
+          break;
+        default:
+          render_text(item.paragraph()->text());
+          close_item(frame);
+          continue;
+      }
+      // the item closes once the nested list is done
+      open_list(nested);
+      lists_.push_back(nested);
+    }
+  }
+
+
+  void open_list(list_frame const& frame) {
+    if (frame.unordered != nullptr) {
+      derived().on_unordered_list_begin(*frame.unordered);
+      if (!frame.unordered->header().empty())
+        derived().on_unordered_list_header(frame.unordered->header());
+    } else {
+      derived().on_ordered_list_begin(*frame.ordered);
+      if (!frame.ordered->header().empty())
+        derived().on_ordered_list_header(frame.ordered->header());
+    }
+  }
+
+
+  void close_item(list_frame& frame) {
+    if (frame.unordered != nullptr)
+      derived().on_unordered_list_item_end(*frame.item);
+    else
+      derived().on_ordered_list_item_end(frame.number, *frame.item);
+    ++frame.item;
+    ++frame.number;
+  }
+
+
+  void render(subsection const& subsection) {
+    if (render_cached(subsection))
+      return;
+    derived().on_subsection_begin(subsection);
+
+    if(!subsection.header().empty()) {
+      derived().on_subsection_header(subsection.header());
+    }
+
+    for(auto const& fragment: subsection)
+      switch(fragment.kind()) {
+        case fragment_kind::paragraph:
+          render(*fragment.paragraph());
+          continue;
+        case fragment_kind::table:
+          render(*fragment.table());
+          continue;
+        case fragment_kind::columnar_table:
+          render(*fragment.columnar_table());
+          continue;
+        case fragment_kind::lazy_table:
+          render(*fragment.lazy_table());
+          continue;
+        case fragment_kind::unordered_list:
+          render(*fragment.unordered_list());
+          continue;
+        case fragment_kind::ordered_list:
+          render(*fragment.ordered_list());
+          continue;
+        default:
+          continue;
+      }
+
+    derived().on_subsection_end(subsection);
+  }
+
+
+  void render(section const& section) {
+    if (render_cached(section))
+      return;
+    derived().on_section_begin(section);
+
+    if (!section.header().empty()) {
+      derived().on_section_header(section.header());
+    }
+    
+    for(auto const& subsection_or_fragment: section)
+      switch(subsection_or_fragment.kind()) {
         case fragment_kind::paragraph:
-          render(*section_or_fragment.paragraph());
+          render(*subsection_or_fragment.paragraph());
           continue;
         case fragment_kind::table:
-          render(*section_or_fragment.table());
+          render(*subsection_or_fragment.table());
+          continue;
+        case fragment_kind::columnar_table:
+          render(*subsection_or_fragment.columnar_table());
+          continue;
+        case fragment_kind::lazy_table:
+          render(*subsection_or_fragment.lazy_table());
           continue;
         case fragment_kind::unordered_list:
-          render(*section_or_fragment.unordered_list());
+          render(*subsection_or_fragment.unordered_list());
           continue;
         case fragment_kind::ordered_list:
-          render(*section_or_fragment.ordered_list());
+          render(*subsection_or_fragment.ordered_list());
           continue;
         case fragment_kind::subsection:
-          render(*section_or_fragment.subsection());
-          continue;
-        case fragment_kind::section:
-          render(*section_or_fragment.section());
+          render(*subsection_or_fragment.subsection());
           continue;
         default:
           continue;
       }
 
-    on_document_end(document);
+    derived().on_section_end(section);
   }
 
 
-  bool write(std::string const& filename, std::error_code& ec) const noexcept {
+  class text const& flat_text(flat_document const& document, flat_document::index_type i) {
+    text_.clear();
+    for (auto j = document.first_child(i); j != flat_document::none; j = document.next_sibling(j))
+      text_.add(span::ref(document.tag(j), document.text(j)));
+    return text_;
+  }
 
-    FILE* file = fopen(filename.data(), "wb+");
-    if (file == nullptr) {
-      ec = std::make_error_code(std::errc(errno));
-      return false;
+
+  void render(flat_document const& document, flat_document::index_type i) {
+    auto const kind = document.kind(i);
+    if (kind == node_kind::unordered_list || kind == node_kind::ordered_list) {
+      render_lists(document, i);
+      return;
     }
+    derived().on_flat_node_begin(document, i);
+    render_node(document, i);
+    derived().on_flat_node_end(document, i);
+  }
 
-    auto const written = fwrite(texter_.data(), sizeof(char), texter_.size(), file);
-    fclose(file);
 
-    if (written != texter_.size()) {
-      ec = std::make_error_code(std::errc(errno));
-      return false;
+  // Flat lists nest through flat_lists_ the way render_lists() walks the
+  // tree, a paragraph in a list is only its text
+  void render_lists(flat_document const& document, flat_document::index_type top) {
+    size_type const base = flat_lists_.size();
+    open_list(document, top);
+
+    while (flat_lists_.size() != base) {
+      auto& frame = flat_lists_.back();
+      if (frame.item == flat_document::none) {
+        auto const list = frame.list;
+        if (document.kind(list) == node_kind::unordered_list)
+          derived().on_unordered_list_end(detail::placeholders::get().unordered_list);
+        else
+          derived().on_ordered_list_end(detail::placeholders::get().ordered_list);
+        derived().on_flat_node_end(document, list);
+        flat_lists_.pop_back();
+        if (flat_lists_.size() != base)
+          close_item(document, flat_lists_.back());
+        continue;
+      }
+
+      auto const item = frame.item;
+      if (document.kind(frame.list) == node_kind::unordered_list)
+        derived().on_unordered_list_item_begin(detail::placeholders::get().list_item);
+      else
+        derived().on_ordered_list_item_begin(frame.number, detail::placeholders::get().list_item);
+
+      if (document.kind(item) != node_kind::paragraph) {
+        // the item closes once the nested list is done
+        open_list(document, item);
+        continue;
+      }
+      derived().on_flat_node_begin(document, item);
+      derived().on_text(flat_text(document, item));
+      derived().on_flat_node_end(document, item);
+      close_item(document, frame);
+    }
+  }
+
+
+  void open_list(flat_document const& document, flat_document::index_type list) {
+    auto const& empty = detail::placeholders::get();
+    derived().on_flat_node_begin(document, list);
+    if (document.kind(list) == node_kind::unordered_list) {
+      derived().on_unordered_list_begin(empty.unordered_list);
+      if (!document.text(list).empty())
+        derived().on_unordered_list_header(document.text(list));
+    } else {
+      derived().on_ordered_list_begin(empty.ordered_list);
+      if (!document.text(list).empty())
+        derived().on_ordered_list_header(document.text(list));
+    }
+    flat_lists_.push_back(flat_list_frame{ list, document.first_child(list) });
+  }
+
+
+  void close_item(flat_document const& document, flat_list_frame& frame) {
+    auto const& empty = detail::placeholders::get();
+    if (document.kind(frame.list) == node_kind::unordered_list)
+      derived().on_unordered_list_item_end(empty.list_item);
+    else
+      derived().on_ordered_list_item_end(frame.number, empty.list_item);
+    frame.item = document.next_sibling(frame.item);
+    ++frame.number;
+  }
+
+
+  void render_node(flat_document const& document, flat_document::index_type i) {
+    using index_type = flat_document::index_type;
+    auto constexpr none = flat_document::none;
+    auto const& empty = detail::placeholders::get();
+
+    switch (document.kind(i)) {
+      case node_kind::paragraph:
+        derived().on_paragraph_begin(empty.paragraph);
+        derived().on_text(flat_text(document, i));
+        derived().on_paragraph_end(empty.paragraph);
+        return;
+
+      case node_kind::table: {
+        derived().on_table_begin(empty.table);
+        index_type const header = document.first_child(i);
+        columns_.clear();
+        for (auto j = document.first_child(header); j != none; j = document.next_sibling(j))
+          columns_.push_back(document.text(j).size());
+        for (auto row = document.next_sibling(header); row != none; row = document.next_sibling(row)) {
+          size_type n = 0;
+          for (auto j = document.first_child(row); j != none; j = document.next_sibling(j), ++n)
+            if (document.text(j).size() > columns_[n])
+              columns_[n] = document.text(j).size();
+        }
+        derived().on_table_columns(columns_);
+
+        if (!columns_.empty()) {
+          derived().on_flat_node_begin(document, header);
+          derived().on_table_header_begin(empty.table.header());
+          std::size_t n = 0;
+          for (auto j = document.first_child(header); j != none; j = document.next_sibling(j))
+            derived().on_table_header_cell(n++, document.text(j));
+          derived().on_table_header_end(empty.table.header());
+          derived().on_flat_node_end(document, header);
+        }
+
+        for (auto row = document.next_sibling(header); row != none; row = document.next_sibling(row)) {
+          derived().on_flat_node_begin(document, row);
+          derived().on_table_row_begin(empty.table_row);
+          std::size_t n = 0;
+          for (auto j = document.first_child(row); j != none; j = document.next_sibling(j), ++n) {
+            auto const cell = span::ref(document.tag(j), document.text(j));
+            derived().on_table_cell_begin(n, cell);
+            derived().on_table_cell_text(n, cell);
+            derived().on_table_cell_end(n, cell);
+          }
+          derived().on_table_row_end(empty.table_row);
+          derived().on_flat_node_end(document, row);
+        }
+
+        derived().on_table_end(empty.table);
+        return;
+      }
+
+      case node_kind::subsection:
+        derived().on_subsection_begin(empty.subsection);
+        if (!document.text(i).empty())
+          derived().on_subsection_header(document.text(i));
+        for (auto j = document.first_child(i); j != none; j = document.next_sibling(j))
+          render(document, j);
+        derived().on_subsection_end(empty.subsection);
+        return;
+
+      case node_kind::section:
+        derived().on_section_begin(empty.section);
+        if (!document.text(i).empty())
+          derived().on_section_header(document.text(i));
+        for (auto j = document.first_child(i); j != none; j = document.next_sibling(j))
+          render(document, j);
+        derived().on_section_end(empty.section);
+        return;
+
+      default:
+        return;
     }
-    
-    return true;
   }
 
+};
+
+
+// Run-time polymorphic formatter, every hook is a virtual call. Streaming
+// with writer and filling a document_template work through this one.
+class formatter: public basic_formatter<formatter> {
+public:
+
+  using basic_formatter::basic_formatter;
+
+  virtual ~formatter() = default;
 
 protected:
 
-  uformat::continuous_texter& texter() noexcept { return texter_; }
+  friend class basic_formatter<formatter>;
+  friend class writer;
+  friend class document_template;
+  friend class live_output;
 
-  virtual void on_document_begin(document const&) { }  
+  virtual void on_document_begin(document const&) { }
   virtual void on_document_end(document const&) { }
-  virtual void on_document_header(std::string const&) { }
+  virtual void on_document_header(std::string_view header) { on_document_header(std::string{ header }); }
   virtual void on_text(text const&) { }
   virtual void on_paragraph_begin(paragraph const&) { }
   virtual void on_paragraph_end(paragraph const&) { }
   virtual void on_table_begin(table const&) { }
   virtual void on_table_end(table const&) { }
+  // widest text in each column, header included, right after on_table_begin
+  virtual void on_table_columns(column_widths const&) { }
   virtual void on_table_header_begin(table_header const&) { }
   virtual void on_table_header_end(table_header const&) { }
-  virtual void on_table_header_cell(std::size_t, std::string const&) { }
+  virtual void on_table_header_cell(std::size_t i, std::string_view text) {
+    on_table_header_cell(i, std::string{ text });
+  }
   virtual void on_table_row_begin(table_row const&) { }
   virtual void on_table_row_end(table_row const&) { }
   virtual void on_table_cell_begin(std::size_t, span const&) { }
@@ -680,184 +4008,805 @@ protected:
   virtual void on_table_cell_text(std::size_t, span const&) { }
   virtual void on_subsection_begin(subsection const&) { }
   virtual void on_subsection_end(subsection const&) { }
-  virtual void on_subsection_header(std::string const&) { }
+  virtual void on_subsection_header(std::string_view header) { on_subsection_header(std::string{ header }); }
   virtual void on_section_begin(section const&) { }
   virtual void on_section_end(section const&) { }
-  virtual void on_section_header(std::string const&) { }
+  virtual void on_section_header(std::string_view header) { on_section_header(std::string{ header }); }
   virtual void on_unordered_list_begin(unordered_list const&) { }
   virtual void on_unordered_list_end(unordered_list const&) { }
-  virtual void on_unordered_list_header(std::string const&) { }
-  virtual void on_unordered_list_item_begin(fragment const&) { }
-  virtual void on_unordered_list_item_end(fragment const&) { }
+  virtual void on_unordered_list_header(std::string_view header) {
+    on_unordered_list_header(std::string{ header });
+  }
+  virtual void on_unordered_list_item_begin(list_item const&) { }
+  virtual void on_unordered_list_item_end(list_item const&) { }
   virtual void on_ordered_list_begin(ordered_list const&) { }
   virtual void on_ordered_list_end(ordered_list const&) { }
+  virtual void on_ordered_list_header(std::string_view header) {
+    on_ordered_list_header(std::string{ header });
+  }
+  virtual void on_ordered_list_item_begin(std::size_t, list_item const&) { }
+  virtual void on_ordered_list_item_end(std::size_t, list_item const&) { }
+
+  // Flat documents, columnar and lazy tables and the writer have no tree
+  // nodes, so their structural begin/end hooks get empty placeholders. The
+  // hooks below bracket those calls with what there is instead: the flat
+  // node, the table itself, or for the writer the kind of node.
+  virtual void on_flat_node_begin(flat_document const&, flat_document::index_type) { }
+  virtual void on_flat_node_end(flat_document const&, flat_document::index_type) { }
+  virtual void on_columnar_table_begin(columnar_table const&) { }
+  virtual void on_columnar_table_end(columnar_table const&) { }
+  virtual void on_lazy_table_begin(lazy_table const&) { }
+  virtual void on_lazy_table_end(lazy_table const&) { }
+  virtual void on_stream_node_begin(node_kind) { }
+  virtual void on_stream_node_end(node_kind) { }
+
+  // Headers used to come as std::string const&. Formatters written against
+  // that still work: unless the string_view hook is overridden, it passes
+  // the header on as a std::string to these.
+  virtual void on_document_header(std::string const&) { }
+  virtual void on_table_header_cell(std::size_t, std::string const&) { }
+  virtual void on_subsection_header(std::string const&) { }
+  virtual void on_section_header(std::string const&) { }
+  virtual void on_unordered_list_header(std::string const&) { }
   virtual void on_ordered_list_header(std::string const&) { }
-  virtual void on_ordered_list_item_begin(std::size_t, fragment const&) { }
-  virtual void on_ordered_list_item_end(std::size_t, fragment const&) { }
+};
 
-private:
 
-  uformat::continuous_texter texter_;
+// Renders a document as it's described instead of building it first.
+// Calls drive the formatter's hooks right away, the way render() would
+// for the equivalent tree, and the output goes to the sink whenever it
+// grows past the threshold, so memory stays flat however long the
+// document gets. Opening a node closes whatever can't hold it, like
+// flat_document::builder. Table widths are either given or sampled from
+// the first rows, see lazy_table. Call finish() to end the document,
+// the destructor only tries to and swallows what finish() would throw.
+class writer {
+public:
+
+  using size_type = formatter::size_type;
+  using sink_type = std::function<void(std::string_view)>;
+
+  static constexpr size_type default_threshold = size_type(1) << 20;
+
+  // throws std::invalid_argument for an empty sink, the output would be lost
+  writer(formatter& formatter, sink_type sink, std::string_view header = {},
+         size_type threshold = default_threshold):
+    formatter_{ formatter }, sink_{ std::move(sink) }, threshold_{ threshold } {
+    if (!sink_)
+      throw std::invalid_argument{ "richtext::writer needs a sink" };
+    formatter_.on_stream_node_begin(node_kind::document);
+    formatter_.on_document_begin(empty().document);
+    if (!header.empty())
+      formatter_.on_document_header(header);
+    open_.push_back(entry{ node_kind::document });
+  }
 
+  writer(writer const&) = delete;
+  writer& operator = (writer const&) = delete;
 
-  void render(paragraph const& paragraph) {
-    on_paragraph_begin(paragraph);
-    on_text(paragraph.text());
-    on_paragraph_end(paragraph);
+  ~writer() {
+    try {
+      finish();
+    } catch (...) {
+    }
   }
 
 
-  void render(table const& table) {
-    on_table_begin(table);
+  writer& begin_section(std::string_view header) {
+    if (!open(node_kind::section))
+      return *this;
+    formatter_.on_section_begin(empty().section);
+    if (!header.empty())
+      formatter_.on_section_header(header);
+    return *this;
+  }
 
-    if(!table.header().empty()) {
-      on_table_header_begin(table.header());
-      std::size_t i = 0;
-      for(std::size_t i = 0; i != table.header().size(); ++i)
-        on_table_header_cell(i, table.header()[i]);
-      on_table_header_end(table.header());
-    }
 
-    for(auto const& row: table) {
-      on_table_row_begin(row);
+  writer& end_section() { return end(node_kind::section); }
+
+
+  writer& begin_subsection(std::string_view header) {
+    if (!open(node_kind::subsection))
+      return *this;
+    formatter_.on_subsection_begin(empty().subsection);
+    if (!header.empty())
+      formatter_.on_subsection_header(header);
+    return *this;
+  }
+
+
+  writer& end_subsection() { return end(node_kind::subsection); }
+
+
+  // inside a list the paragraph becomes its next item
+  writer& paragraph(class paragraph const& paragraph) {
+    if (!open(node_kind::paragraph))
+      return *this;
+    open_.pop_back();
+    auto& parent = open_.back();
+    if (parent.kind == node_kind::unordered_list || parent.kind == node_kind::ordered_list) {
+      begin_item(parent);
+      formatter_.on_text(paragraph.text());
+      end_item(parent);
+    } else
+      formatter_.render(paragraph);
+    formatter_.on_stream_node_end(node_kind::paragraph);
+    return flush_if_full();
+  }
 
-      std::size_t i = 0;
-      for(auto const& cell: row) {
-        on_table_cell_begin(i, cell);
-        on_table_cell_text(i, cell);
-        on_table_cell_end(i, cell);
-        ++i;
-      }
 
-      on_table_row_end(row);
+  writer& paragraph(std::string_view text) {
+    formatter_.text_.clear();
+    formatter_.text_.add(span::ref(text));
+    return paragraph(formatter_.text_);
+  }
+
+
+  writer& paragraph(class text const& text) {
+    auto const& placeholder = empty().paragraph;
+    if (!open(node_kind::paragraph))
+      return *this;
+    open_.pop_back();
+    auto& parent = open_.back();
+    if (parent.kind == node_kind::unordered_list || parent.kind == node_kind::ordered_list) {
+      begin_item(parent);
+      formatter_.on_text(text);
+      end_item(parent);
+    } else {
+      formatter_.on_paragraph_begin(placeholder);
+      formatter_.on_text(text);
+      formatter_.on_paragraph_end(placeholder);
     }
+    formatter_.on_stream_node_end(node_kind::paragraph);
+    return flush_if_full();
+  }
 
-    on_table_end(table);
+
+  writer& begin_unordered_list(std::string_view header = {}) {
+    if (!open(node_kind::unordered_list))
+      return *this;
+    formatter_.on_unordered_list_begin(empty().unordered_list);
+    if (!header.empty())
+      formatter_.on_unordered_list_header(header);
+    return *this;
   }
 
 
-  void render(unordered_list const& unordered_list) {
-    on_unordered_list_begin(unordered_list);
+  writer& end_unordered_list() { return end(node_kind::unordered_list); }
 
-    if (!unordered_list.header().empty())
-      on_unordered_list_header(unordered_list.header());
 
-    for(auto const& item: unordered_list) {
-      on_unordered_list_item_begin(*item);
+  writer& begin_ordered_list(std::string_view header = {}) {
+    if (!open(node_kind::ordered_list))
+      return *this;
+    formatter_.on_ordered_list_begin(empty().ordered_list);
+    if (!header.empty())
+      formatter_.on_ordered_list_header(header);
+    return *this;
+  }
 
-      switch(item->kind()) {
-        case fragment_kind::paragraph:
-          on_text(item->paragraph()->text());
-          break;
-        case fragment_kind::unordered_list:
-          render(*item->unordered_list());
-          break;
-        case fragment_kind::ordered_list:
-          render(*item->ordered_list());
-          break;
-        default:
-          break;
-      }
-      
-      on_unordered_list_item_end(*item);
+
+  writer& end_ordered_list() { return end(node_kind::ordered_list); }
+
+
+  // without widths, the first sample_size rows are held to measure them
+  writer& begin_table(table_header header, lazy_table::widths_type widths = {},
+                      size_type sample_size = lazy_table::default_sample_size) {
+    if (!open(node_kind::table))
+      return *this;
+    formatter_.on_table_begin(empty().table);
+    header_ = std::move(header);
+    sampled_ = 0;
+    sample_size_ = sample_size;
+    if (widths.size() == header_.size()) {
+      formatter_.columns_ = std::move(widths);
+      for (size_type i = 0; i != header_.size(); ++i)
+        formatter_.columns_[i] = std::max(formatter_.columns_[i], header_[i].size());
+      formatter_.render(header_);
+      open_.back().items = 1;
     }
+    return *this;
+  }
 
-    on_unordered_list_end(unordered_list);
+
+  // rows that don't match the header are skipped like table::add does
+  writer& row(table_row row) {
+    if (open_.empty() || open_.back().kind != node_kind::table || row.size() != header_.size())
+      return *this;
+    auto& table = open_.back();
+    if (table.items != 0) {
+      formatter_.render(row);
+      return flush_if_full();
+    }
+    if (sample_.size() == sampled_)
+      sample_.emplace_back();
+    // a held row may point at a buffer the caller reuses for the next one
+    sample_[sampled_] = std::move(row);
+    sample_[sampled_++].own();
+    if (sampled_ >= sample_size_)
+      flush_sample();
+    return *this;
   }
 
 
-  void render(ordered_list const& ordered_list) {    
-    on_ordered_list_begin(ordered_list);
+  writer& end_table() { return end(node_kind::table); }
 
-    if (!ordered_list.header().empty())
-      on_ordered_list_header(ordered_list.header());
 
-    std::size_t i = 1;
-    for (auto const& item : ordered_list) {
-      on_ordered_list_item_begin(i, *item);
+  // closes everything still open and ends the document
+  void finish() {
+    if (open_.empty())
+      return;
+    while (open_.size() > 1)
+      close();
+    open_.clear();
+    formatter_.on_document_end(empty().document);
+    formatter_.on_stream_node_end(node_kind::document);
+    flush();
+  }
 
-      switch(item->kind()) {
-        case fragment_kind::paragraph:
-          on_text(item->paragraph()->text());
-          break;
-        case fragment_kind::unordered_list:
-          render(*item->unordered_list());
-          break;
-        case fragment_kind::ordered_list:
-          render(*item->ordered_list());
-          break;
-        default:
-          break;
+
+  void flush() {
+    if (formatter_.size() != 0)
+      sink_(std::string_view{ formatter_.data(), formatter_.size() });
+    formatter_.clear();
+  }
+
+private:
+
+  struct entry {
+    node_kind kind;
+    // items of a list so far, for tables whether the header is out
+    size_type items{ 0 };
+  };
+
+  formatter& formatter_;
+  sink_type sink_;
+  size_type threshold_;
+  std::vector<entry> open_;
+  table_header header_{ pmr::allocator_type{ std::pmr::new_delete_resource() } };
+  std::pmr::vector<table_row> sample_{ std::pmr::new_delete_resource() };
+  size_type sampled_{ 0 };
+  size_type sample_size_{ 0 };
+
+
+  static detail::placeholders const& empty() noexcept { return detail::placeholders::get(); }
+
+
+  static bool holds(node_kind parent, node_kind child) noexcept {
+    switch (child) {
+      case node_kind::section:
+        return parent == node_kind::document;
+      case node_kind::subsection:
+        return parent == node_kind::document || parent == node_kind::section;
+      case node_kind::table:
+        return parent == node_kind::document || parent == node_kind::section
+            || parent == node_kind::subsection;
+      case node_kind::paragraph:
+      case node_kind::unordered_list:
+      case node_kind::ordered_list:
+        return parent == node_kind::document || parent == node_kind::section
+            || parent == node_kind::subsection || parent == node_kind::unordered_list
+            || parent == node_kind::ordered_list;
+      default:
+        return false;
+    }
+  }
+
+
+  bool open(node_kind kind) {
+    auto i = open_.size();
+    while (i != 0 && !holds(open_[i - 1].kind, kind))
+      --i;
+    if (i == 0)
+      return false;
+    while (open_.size() != i)
+      close();
+    auto& parent = open_.back();
+    // a nested list is an item of its parent list
+    if (kind != node_kind::paragraph
+        && (parent.kind == node_kind::unordered_list || parent.kind == node_kind::ordered_list))
+      begin_item(parent);
+    open_.push_back(entry{ kind });
+    formatter_.on_stream_node_begin(kind);
+    return true;
+  }
+
+
+  writer& end(node_kind kind) {
+    for (auto i = open_.size(); i > 1; --i)
+      if (open_[i - 1].kind == kind) {
+        while (open_.size() >= i)
+          close();
+        break;
       }
-      
-      on_ordered_list_item_end(i, *item);
-      ++i;
+    return flush_if_full();
+  }
+
+
+  void close() {
+    auto const e = open_.back();
+    switch (e.kind) {
+      case node_kind::section:
+        formatter_.on_section_end(empty().section);
+        break;
+      case node_kind::subsection:
+        formatter_.on_subsection_end(empty().subsection);
+        break;
+      case node_kind::unordered_list:
+        formatter_.on_unordered_list_end(empty().unordered_list);
+        break;
+      case node_kind::ordered_list:
+        formatter_.on_ordered_list_end(empty().ordered_list);
+        break;
+      case node_kind::table:
+        if (e.items == 0)
+          flush_sample();
+        formatter_.on_table_end(empty().table);
+        break;
+      default:
+        break;
+    }
+    formatter_.on_stream_node_end(e.kind);
+    open_.pop_back();
+    auto& parent = open_.back();
+    if (parent.kind == node_kind::unordered_list || parent.kind == node_kind::ordered_list)
+      end_item(parent);
+  }
+
+
+  void begin_item(entry& list) {
+    ++list.items;
+    if (list.kind == node_kind::unordered_list)
+      formatter_.on_unordered_list_item_begin(empty().list_item);
+    else
+      formatter_.on_ordered_list_item_begin(list.items, empty().list_item);
+  }
+
+
+  void end_item(entry const& list) {
+    if (list.kind == node_kind::unordered_list)
+      formatter_.on_unordered_list_item_end(empty().list_item);
+    else
+      formatter_.on_ordered_list_item_end(list.items, empty().list_item);
+  }
+
+
+  // widths from the rows held so far, then the header and those rows
+  void flush_sample() {
+    auto& columns = formatter_.columns_;
+    columns.resize(header_.size());
+    for (size_type i = 0; i != header_.size(); ++i)
+      columns[i] = header_[i].size();
+    for (size_type r = 0; r != sampled_; ++r)
+      for (size_type i = 0; i != header_.size(); ++i)
+        if (sample_[r].at(i).length() > columns[i])
+          columns[i] = sample_[r].at(i).length();
+    formatter_.render(header_);
+    for (size_type r = 0; r != sampled_; ++r) {
+      formatter_.render(sample_[r]);
+      sample_[r].clear();
     }
+    sampled_ = 0;
+    open_.back().items = 1;
+    flush_if_full();
+  }
 
-    on_ordered_list_end(ordered_list);
+
+  writer& flush_if_full() {
+    if (formatter_.size() >= threshold_)
+      flush();
+    return *this;
   }
+};
 
 
-  void render(subsection const& subsection) {
-    on_subsection_begin(subsection);
+// A document compiled once against a formatter into static bytes and slots,
+// every render() only formats the slot values. Tables holding slots are
+// rendered again each time since a value can change their column widths.
+// Everything else is rendered once when compiled and its hooks never run
+// again, so a slot value must not change how the text around it renders.
+class document_template {
+public:
 
-    if(!subsection.header().empty()) {
-      on_subsection_header(subsection.header());
+  using size_type = formatter::size_type;
+
+  static constexpr size_type npos = size_type(-1);
+
+  document_template(formatter& formatter, document document):
+    formatter_{ formatter }, document_{ std::move(document) } {
+    auto& texter = formatter_.texter_;
+    origin_ = mark_ = texter.size();
+    {
+      binding const bound{ *this };
+      compiling_ = true;
+      formatter_.render(document_);
     }
+    cut();
+    bytes_.assign(texter.data() + origin_, texter.size() - origin_);
+    texter.string().resize(origin_);
+  }
 
-    for(auto const& fragment: subsection)
-      switch(fragment.kind()) {
-        case fragment_kind::paragraph:
-          render(*fragment.paragraph());
-          continue;
-        case fragment_kind::table:
-          render(*fragment.table());
-          continue;
-        case fragment_kind::unordered_list:
-          render(*fragment.unordered_list());
+  document_template(document_template const&) = delete;
+  document_template& operator = (document_template const&) = delete;
+
+  size_type slots_count() const noexcept { return values_.size(); }
+
+  // empty for a slot out of range
+  std::string_view name(size_type slot) const noexcept {
+    return slot < names_.size() ? names_[slot] : std::string_view{};
+  }
+
+  size_type find(std::string_view name) const noexcept {
+    auto const found = slots_.find(name);
+    return found != slots_.end() ? found->second : npos;
+  }
+
+
+  // slots out of range are ignored
+  document_template& set(size_type slot, std::string_view text) {
+    if (slot >= values_.size())
+      return *this;
+    return set(slot, span{ tags_[slot], text });
+  }
+
+  template<typename T, typename = std::enable_if_t<std::is_integral_v<T> && !std::is_same_v<T, bool>>>
+  document_template& set(size_type slot, T value) {
+    if (slot >= values_.size())
+      return *this;
+    if constexpr (std::is_signed_v<T>)
+      return set(slot, span{ tags_[slot], std::int64_t(value) });
+    else
+      return set(slot, span{ tags_[slot], std::uint64_t(value) });
+  }
+
+  document_template& set(size_type slot, double value, unsigned precision) {
+    if (slot >= values_.size())
+      return *this;
+    return set(slot, span{ tags_[slot], value, precision });
+  }
+
+  // By name, unknown names are ignored. Integers never count as names,
+  // so set(0, "text") picks the slot.
+  template<typename Name, typename... Args>
+  auto set(Name const& name, Args&&... args)
+    -> std::enable_if_t<!std::is_integral_v<Name> && std::is_convertible_v<Name const&, std::string_view>,
+                        document_template&> {
+    auto const slot = find(name);
+    if (slot == npos)
+      return *this;
+    return set(slot, std::forward<Args>(args)...);
+  }
+
+
+  // appends one instance to the formatter output
+  void render() {
+    auto& texter = formatter_.texter_;
+    formatter::measure const measured{ formatter_ };
+    binding const bound{ *this };
+    for (auto const& segment: segments_)
+      switch (segment.kind) {
+        case segment_kind::bytes:
+          texter.append(bytes_.data() + segment.offset, segment.size);
           continue;
-        case fragment_kind::ordered_list:
-          render(*fragment.ordered_list());
+        case segment_kind::slot:
+          formatter_.on_text(values_[segment.slot]);
           continue;
-        default:
+        case segment_kind::table:
+          formatter_.render(*segment.table);
           continue;
       }
+  }
 
-    on_subsection_end(subsection);
+private:
+
+  template<typename> friend class basic_formatter;
+
+  enum class segment_kind { bytes, slot, table };
+
+  // points the formatter at the template for as long as it lives, so a
+  // throwing hook doesn't leave it pointing at a template that's gone
+  struct binding {
+    document_template& owner;
+
+    explicit binding(document_template& owner) noexcept: owner{ owner } {
+      owner.formatter_.template_ = &owner;
+    }
+
+    ~binding() {
+      owner.formatter_.template_ = nullptr;
+      owner.compiling_ = false;
+    }
+
+    binding(binding const&) = delete;
+    binding& operator = (binding const&) = delete;
+  };
+
+  struct segment {
+    segment_kind kind;
+    size_type offset{ 0 };
+    size_type size{ 0 };
+    size_type slot{ 0 };
+    class table const* table{ nullptr };
+  };
+
+  formatter& formatter_;
+  document document_;
+  std::string bytes_;
+  std::vector<segment> segments_;
+  std::unordered_map<std::string_view, size_type> slots_;
+  std::vector<std::string_view> names_;
+  std::vector<enum tag> tags_;
+  // each value is a text of a single span
+  std::vector<class text> values_;
+  bool compiling_{ false };
+  size_type origin_{ 0 };
+  size_type mark_{ 0 };
+
+
+  document_template& set(size_type slot, span value) {
+    auto& text = values_[slot];
+    text.clear();
+    text.add(std::move(value));
+    return *this;
   }
 
 
-  void render(section const& section) {
-    on_section_begin(section);
+  size_type add(span const& placeholder) {
+    auto const name = placeholder.text();
+    auto const found = slots_.find(name);
+    if (found != slots_.end())
+      return found->second;
+    size_type const slot = values_.size();
+    slots_.emplace(name, slot);
+    names_.push_back(name);
+    tags_.push_back(placeholder.tag());
+    values_.emplace_back().add(span{ placeholder.tag(), std::string_view{} });
+    return slot;
+  }
 
-    if (!section.header().empty()) {
-      on_section_header(section.header());
+
+  // closes the static bytes written since the last segment
+  void cut() {
+    size_type const end = formatter_.texter_.size();
+    if (end != mark_)
+      segments_.push_back(segment{ segment_kind::bytes, mark_ - origin_, end - mark_ });
+    mark_ = end;
+  }
+
+
+  void cut(segment next) {
+    cut();
+    segments_.push_back(next);
+  }
+};
+
+
+template<typename Derived>
+void basic_formatter<Derived>::render_text(class text const& text) {
+  if (template_ == nullptr || !template_->compiling_ ||
+      std::none_of(text.begin(), text.end(), [](span const& s) { return s.slot(); })) {
+    derived().on_text(text);
+    return;
+  }
+  // runs between slots are formatted on their own
+  text_.clear();
+  for (auto const& item: text) {
+    if (!item.slot()) {
+      text_.add(span::borrow(item));
+      continue;
     }
-    
-    for(auto const& subsection_or_fragment: section)
-      switch(subsection_or_fragment.kind()) {
-        case fragment_kind::paragraph:
-          render(*subsection_or_fragment.paragraph());
-          continue;
-        case fragment_kind::table:
-          render(*subsection_or_fragment.table());
-          continue;
-        case fragment_kind::unordered_list:
-          render(*subsection_or_fragment.unordered_list());
-          continue;
-        case fragment_kind::ordered_list:
-          render(*subsection_or_fragment.ordered_list());
-          continue;
-        case fragment_kind::subsection:
-          render(*subsection_or_fragment.subsection());
-          continue;
-        default:
-          continue;
+    if (!text_.empty())
+      derived().on_text(text_);
+    text_.clear();
+    document_template::segment slot{ document_template::segment_kind::slot };
+    slot.slot = template_->add(item);
+    template_->cut(slot);
+  }
+  if (!text_.empty())
+    derived().on_text(text_);
+}
+
+
+template<typename Derived>
+span const& basic_formatter<Derived>::resolve(span const& cell) const noexcept {
+  if (template_ == nullptr || template_->compiling_ || !cell.slot())
+    return cell;
+  return *template_->values_[template_->find(cell.text())].begin();
+}
+
+
+template<typename Derived>
+bool basic_formatter<Derived>::deferred(class table const& table) {
+  if (!template_->compiling_)
+    return false;
+  bool slots = false;
+  for (auto const& row: table)
+    for (auto const& cell: row)
+      if (cell.slot()) {
+        template_->add(cell);
+        slots = true;
       }
+  if (!slots)
+    return false;
+  document_template::segment deferred{ document_template::segment_kind::table };
+  deferred.table = &table;
+  template_->cut(deferred);
+  return true;
+}
+
+
+// Output of a document kept current while the document changes. Every
+// top-level item keeps its own bytes, and refresh() renders again only
+// the items whose revisions moved since the last time, splicing their
+// bytes in place of the old ones, so a refresh costs what changed rather
+// than the whole document. Items are told apart by the revisions of the
+// nodes in them, hence changes have to go through the nodes themselves.
+// Revisions are never reused, so a node put in place of another, even of
+// the same kind, is always told apart from it.
+// Columnar and lazy tables borrow their data and render on every refresh.
+// The formatter serves as scratch space. An item left unchanged keeps its
+// bytes while the ones before it render again, so its output must not
+// depend on them.
+class live_output {
+public:
+
+  using size_type = formatter::size_type;
+
+  live_output(formatter& formatter, document const& document) noexcept:
+    formatter_{ formatter }, document_{ document } { }
+  live_output(live_output const&) = delete;
+  live_output& operator = (live_output const&) = delete;
+
+  size_type size() const noexcept { return size_; }
+
+  // Renders the whole document the first time and after items were added
+  // or removed, the changed items otherwise. Returns how many were rendered.
+  size_type refresh() {
+    if (!rendered_ || revision_ != document_.revision())
+      return render();
+    size_type rendered = 0;
+    for (size_type i = 0; i != items_.size(); ++i) {
+      auto& item = items_[i];
+      auto const& node = document_.at(i);
+      std::uint64_t stamp = detail::hash_seed;
+      bool const stable = stamp_node(node, stamp);
+      if (stable && item.stable && stamp == item.stamp)
+        continue;
+      formatter_.clear();
+      formatter_.render(node);
+      size_ -= item.bytes.size();
+      item.bytes.assign(formatter_.data(), formatter_.size());
+      size_ += item.bytes.size();
+      item.stamp = stamp;
+      item.stable = stable;
+      item.shared = shared(node);
+      ++rendered;
+    }
+    return rendered;
+  }
+
+  // the next refresh() renders everything
+  void invalidate() noexcept { rendered_ = false; }
+
+  // calls f with consecutive pieces of the output
+  template<typename F>
+  void for_each(F&& f) const {
+    f(std::string_view{ head_ });
+    for (auto const& item: items_)
+      f(std::string_view{ item.bytes });
+    f(std::string_view{ tail_ });
+  }
+
+  std::string string() const {
+    std::string joined;
+    joined.reserve(size_);
+    for_each([&](std::string_view piece) { joined.append(piece); });
+    return joined;
+  }
+
+private:
+
+  struct item {
+    std::string bytes;
+    std::uint64_t stamp{ 0 };
+    bool stable{ false };
+    // a shared section is stamped by its address, holding on to it keeps
+    // a section made later from landing there and taking the same stamp
+    std::shared_ptr<section const> shared;
+  };
+
+  formatter& formatter_;
+  document const& document_;
+  std::string head_;
+  std::string tail_;
+  std::vector<item> items_;
+  size_type size_{ 0 };
+  std::uint64_t revision_{ 0 };
+  bool rendered_{ false };
+
+
+  size_type render() {
+    formatter_.clear();
+    formatter_.on_document_begin(document_);
+    if (!document_.header().empty())
+      formatter_.on_document_header(document_.header());
+    head_.assign(formatter_.data(), formatter_.size());
+    size_ = head_.size();
+    items_.resize(document_.size());
+    for (size_type i = 0; i != items_.size(); ++i) {
+      auto& item = items_[i];
+      auto const& node = document_.at(i);
+      item.stamp = detail::hash_seed;
+      item.stable = stamp_node(node, item.stamp);
+      item.shared = shared(node);
+      formatter_.clear();
+      formatter_.render(node);
+      item.bytes.assign(formatter_.data(), formatter_.size());
+      size_ += item.bytes.size();
+    }
+    formatter_.clear();
+    formatter_.on_document_end(document_);
+    tail_.assign(formatter_.data(), formatter_.size());
+    size_ += tail_.size();
+    revision_ = document_.revision();
+    rendered_ = true;
+    return items_.size();
+  }
+
+
+  static std::shared_ptr<section const> shared(section_or_fragment const& node) {
+    auto const* const shared = node.shared_section();
+    return shared != nullptr ? *shared : nullptr;
+  }
 
-    on_section_end(section);
+
+  // folds the revisions of a node and everything in it into hash, false
+  // when the node has to be rendered anyway
+  template<typename Node>
+  static bool stamp_node(Node const& node, std::uint64_t& hash) noexcept {
+    hash = detail::combine(hash, std::uint64_t(node.kind()));
+    if (auto const* paragraph = node.paragraph()) {
+      hash = detail::combine(hash, paragraph->text().revision());
+      return true;
+    }
+    if (auto const* table = node.table()) {
+      hash = detail::combine(hash, table->revision());
+      return true;
+    }
+    if (auto const* list = node.unordered_list()) {
+      hash = detail::combine(hash, list->revision());
+      return true;
+    }
+    if (auto const* list = node.ordered_list()) {
+      hash = detail::combine(hash, list->revision());
+      return true;
+    }
+    if (node.columnar_table() || node.lazy_table())
+      return false;
+    if constexpr (!std::is_same_v<Node, fragment>) {
+      if (auto const* subsection = node.subsection())
+        return stamp_items(*subsection, hash);
+    }
+    if constexpr (std::is_same_v<Node, section_or_fragment>) {
+      // shared sections don't change, the pointer tells them apart
+      if (auto const* shared = node.shared_section()) {
+        hash = detail::combine(hash, reinterpret_cast<std::uintptr_t>(shared->get()));
+        return true;
+      }
+      if (auto const* section = node.section())
+        return stamp_items(*section, hash);
+    }
+    return true;
   }
 
+
+  template<typename Container>
+  static bool stamp_items(Container const& container, std::uint64_t& hash) noexcept {
+    hash = detail::combine(hash, container.revision());
+    bool stable = true;
+    for (auto const& node: container)
+      stable = stamp_node(node, hash) && stable;
+    return stable;
+  }
 };
 
 
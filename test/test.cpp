@@ -3,6 +3,12 @@
 
 #include <richtext/richtext.hpp>
 #include <richtext/formatters/markdown.hpp>
+#include <thread>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 
 TEST_CASE("richtext") {
@@ -33,3 +39,1260 @@ TEST_CASE("richtext") {
   md.render(doc);
   std::error_code ec; md.write("test.md", ec);
 }
+
+
+TEST_CASE("continuous_string grows in place") {
+
+  uformat::continuous_string<> s;
+  char const* const data = s.data();
+  for(int i = 0; i != 100000; ++i)
+    s.push_back(char('a' + i % 26));
+  REQUIRE(s.size() == 100000);
+  REQUIRE(s.data() == data);
+  REQUIRE(s[0] == 'a');
+  REQUIRE(s[99999] == char('a' + 99999 % 26));
+  REQUIRE(s.data()[s.size()] == '\0');
+}
+
+
+TEST_CASE("continuous_string with huge pages") {
+
+  uformat::continuous_string<> regular;
+  uformat::continuous_string<> huge{uformat::pages::huge};
+  REQUIRE(huge.pages() == uformat::pages::huge);
+  REQUIRE(huge.committed_capacity() == huge.huge_page_size);
+  REQUIRE(reinterpret_cast<std::uintptr_t>(huge.data()) % huge.huge_page_size == 0);
+  for(int i = 0; i != 4 * 1024 * 1024; ++i) {
+    regular.push_back('x');
+    huge.push_back('x');
+  }
+  REQUIRE(huge.size() == regular.size());
+  REQUIRE(huge.commits() < regular.commits());
+}
+
+
+TEST_CASE("formatter reuse") {
+
+  using namespace richtext;
+  formatters::markdown md;
+  auto doc = document{ "Header" }
+    .add(paragraph{ std::string(100000, 'x') });
+
+  md.render(doc);
+  std::string const first{md.data(), md.size()};
+  auto const commits = md.string().commits();
+  char const* const data = md.data();
+  // a cold buffer commits and faults its pages in
+  REQUIRE(md.render_stats().commits > 0);
+#if defined(__linux__)
+  REQUIRE(md.render_stats().faults > 0);
+#endif
+
+  md.clear();
+  REQUIRE(md.size() == 0);
+  REQUIRE(md.render_stats().commits == 0);
+  REQUIRE(md.render_stats().faults == 0);
+  md.render(doc);
+  REQUIRE(std::string{md.data(), md.size()} == first);
+  REQUIRE(md.data() == data);
+  REQUIRE(md.string().commits() == commits);
+  REQUIRE(md.render_stats().commits == 0);
+
+  md.high_water(65536).clear();
+  REQUIRE(md.string().committed_capacity() <= md.high_water());
+  md.render(doc);
+  REQUIRE(std::string{md.data(), md.size()} == first);
+  REQUIRE(md.render_stats().commits > 0);
+}
+
+
+TEST_CASE("continuous_string region pool") {
+
+  using string = uformat::continuous_string<>;
+  auto& pool = string::pool(uformat::pages::regular);
+  { string warmup; }
+
+  auto const hits = pool.hits();
+  char const* data;
+  { string s; s.append(std::string(10000, 'x')); data = s.data(); }
+  { string s; REQUIRE(s.data() == data); REQUIRE(s.empty()); }
+  REQUIRE(pool.hits() == hits + 2);
+
+  std::thread{[] { string s; s.push_back('x'); }}.join();
+  std::thread{[&] { string s; REQUIRE(s.data() != nullptr); }}.join();
+}
+
+
+#if defined(__linux__)
+
+TEST_CASE("formatter output sealed in memfd") {
+
+  using namespace richtext;
+  formatters::markdown md{ formatters::markdown::options{}.pages(uformat::pages::memfd) };
+  md.render(document{ "Header" }.add(paragraph{ std::string(10000, 'x') }));
+  std::string const rendered{md.data(), md.size()};
+
+  int const fd = md.seal();
+  REQUIRE(fd != -1);
+  REQUIRE(md.size() == 0);
+  REQUIRE((fcntl(fd, F_GET_SEALS) & F_SEAL_WRITE) != 0);
+  REQUIRE(lseek(fd, 0, SEEK_END) == off_t(rendered.size()));
+
+  std::string contents(rendered.size(), '\0');
+  REQUIRE(pread(fd, contents.data(), contents.size(), 0) == ssize_t(contents.size()));
+  REQUIRE(contents == rendered);
+  REQUIRE(ftruncate(fd, 0) != 0);
+  close(fd);
+
+  md.render(document{ "Next" });
+  REQUIRE(md.string().fd() != -1);
+
+  std::string const next{md.data(), md.size()};
+  REQUIRE(fcntl(md.string().fd(), F_ADD_SEALS, F_SEAL_SEAL) == 0);
+  REQUIRE(md.seal() == -1);
+  REQUIRE(std::string{md.data(), md.size()} == next);
+  REQUIRE(md.string().fd() != -1);
+  md.clear();
+  md.render(document{ "Next" }.add(paragraph{ std::string(10000, 'y') }));
+  REQUIRE(md.size() > 10000);
+}
+
+#endif
+
+
+TEST_CASE("texter write window") {
+
+  uformat::continuous_texter t;
+  char* p = t.prepare(16);
+  REQUIRE(p != nullptr);
+  *p++ = 'a'; *p++ = 'b';
+  t.commit(p);
+  t << int64_t(-42) << ' ';
+  t.fixed(uint32_t(7), 3).print(' ').fixed(2.5, 2);
+  REQUIRE(std::string{t.data(), t.size()} == "ab-42 007 2.50");
+
+  uformat::short_texter s;
+  REQUIRE(s.prepare(1000) == nullptr);
+  REQUIRE(s.empty());
+
+  using namespace richtext;
+  formatters::markdown md;
+  md.render(document{}.add(paragraph{}.add(tag::strong, "a_b*c|d")));
+  REQUIRE(std::string{md.data(), md.size()} == "**a\\_b\\*c\\|d**\n\n");
+}
+
+
+TEST_CASE("long table cells") {
+
+  uformat::small_texter t;
+  t << std::string(1000, 'x');
+  REQUIRE(t.size() == 1000);
+  REQUIRE(t.string().spilled());
+
+  using namespace richtext;
+  std::string const cell(3000, 'y');
+  formatters::markdown md;
+  md.render(document{}.add(table{ {"A", "B"} }
+    .add(table_row{}.add("1").add(cell))
+    .add(table_row{}.add(cell).add("2"))));
+  std::string const rendered{md.data(), md.size()};
+  REQUIRE(rendered.find("| 1" + std::string(2999, ' ') + " | " + cell + " |\n") != std::string::npos);
+  REQUIRE(rendered.find("| " + cell + " | " + std::string(2999, ' ') + "2 |\n") != std::string::npos);
+
+  // right-aligned text is escaped in place and shifted past its padding
+  md.clear();
+  md.render(document{}
+    .add(table{ {"A", "Bold column"} }.add(table_row{}.add("1").add(tag::strong, "a|b")))
+    .add(table{ {"A", "B"} }.add(table_row{}.add("2").add(tag::emphasis, "x_y"))));
+  std::string const shifted{md.data(), md.size()};
+  REQUIRE(shifted.find("| 1 |    **a\\|b** |\n") != std::string::npos);
+  REQUIRE(shifted.find("| 2 | *x\\_y* |\n") != std::string::npos);
+}
+
+
+TEST_CASE("document in arena") {
+
+  using namespace richtext;
+  auto const build = [](pmr::allocator_type const& allocator) {
+    return document{"Report", allocator}
+      .add(section{"Section"}
+        .add(paragraph{}.add("plain ").add(tag::strong, "strong"))
+        .add(table{ {"A", "B"} }.add(table_row{}.add("1").add("2")))
+        .add(unordered_list{"List"}
+          .add(paragraph{"item"})
+          .add(ordered_list{}.add(paragraph{"nested"}))));
+  };
+
+  formatters::markdown expected;
+  expected.render(build(pmr::allocator()));
+
+  unordered_list outside;
+  outside.add(paragraph{"moved in"});
+
+  pmr::arena arena;
+  // children built without an allocator move into the document's arena
+  auto const doc = build(arena.allocator());
+  REQUIRE(doc.get_allocator().resource() == arena.resource());
+  auto const* const s = doc.begin()->section();
+  REQUIRE(s != nullptr);
+  REQUIRE(s->get_allocator().resource() == arena.resource());
+  auto const* const list = std::next(s->begin(), 2)->unordered_list();
+  REQUIRE(list != nullptr);
+  REQUIRE(list->begin()->paragraph()->get_allocator().resource() == arena.resource());
+  REQUIRE(std::next(list->begin())->ordered_list()->get_allocator().resource() == arena.resource());
+
+  formatters::markdown md;
+  md.render(doc);
+  REQUIRE(std::string_view{md.data(), md.size()} == std::string_view{expected.data(), expected.size()});
+
+  auto const other = document{ arena.allocator() }.add(std::move(outside));
+  auto const* const moved = other.begin()->unordered_list();
+  REQUIRE(moved->get_allocator().resource() == arena.resource());
+  REQUIRE(moved->begin()->paragraph()->text().begin()->text() == "moved in");
+
+  // nothing else built meanwhile lands in the arena
+  paragraph const unrelated{ "not in the arena" };
+  REQUIRE(unrelated.get_allocator().resource() == pmr::resource());
+}
+
+
+namespace {
+
+  // written against the header hooks as they were before string_view
+  struct string_headers: richtext::formatter {
+    std::vector<std::string> headers;
+
+    void on_document_header(std::string const& header) override { headers.push_back(header); }
+    void on_section_header(std::string const& header) override { headers.push_back(header); }
+    void on_subsection_header(std::string const& header) override { headers.push_back(header); }
+    void on_unordered_list_header(std::string const& header) override { headers.push_back(header); }
+    void on_ordered_list_header(std::string const& header) override { headers.push_back(header); }
+
+    void on_table_header_cell(std::size_t, std::string const& text) override {
+      headers.push_back(text);
+    }
+  };
+
+}
+
+
+TEST_CASE("formatter with string headers") {
+
+  using namespace richtext;
+  string_headers f;
+  f.render(document{ "Report" }
+    .add(section{ "Section" }
+      .add(subsection{ "Subsection" }
+        .add(table{ {"Column"} })
+        .add(unordered_list{ "Unordered" }.add(ordered_list{ "Ordered" })))));
+  REQUIRE(f.headers == std::vector<std::string>{
+    "Report", "Section", "Subsection", "Column", "Unordered", "Ordered" });
+}
+
+
+TEST_CASE("borrowed spans") {
+
+  using namespace richtext;
+  std::string const buffer = "12.5|name_1|plain";
+  std::string_view const view{buffer};
+
+  auto const borrowed = span::ref(tag::strong, view.substr(0, 4));
+  REQUIRE(borrowed.borrowed());
+  REQUIRE(borrowed.text().data() == buffer.data());
+  REQUIRE(borrowed.length() == 4);
+  REQUIRE(span::ref({}).borrowed());
+  REQUIRE(!span{"owned"}.borrowed());
+
+  auto const build = [&](bool ref) {
+    auto row = table_row{};
+    auto p = paragraph{};
+    if(ref) {
+      row.add_ref(view.substr(0, 4)).add_ref(tag::emphasis, view.substr(5, 6));
+      p.add_ref(view.substr(12)).add_ref(tag::strong, view.substr(5, 6));
+    } else {
+      row.add(std::string{view.substr(0, 4)}).add(tag::emphasis, std::string{view.substr(5, 6)});
+      p.add(std::string{view.substr(12)}).add(tag::strong, std::string{view.substr(5, 6)});
+    }
+    return document{}.add(std::move(p)).add(table{ {"Value", "Name"} }.add(std::move(row)));
+  };
+
+  auto const doc = build(true);
+  REQUIRE(doc.begin()->paragraph()->text().length() == 11);
+  formatters::markdown owned, refs;
+  owned.render(build(false));
+  refs.render(doc);
+  REQUIRE(std::string_view{refs.data(), refs.size()} == std::string_view{owned.data(), owned.size()});
+}
+
+
+namespace {
+
+  // what the hooks of the paths without tree nodes tell apart
+  struct node_recorder final: richtext::basic_formatter<node_recorder> {
+    std::vector<richtext::node_kind> kinds;
+    std::size_t open{ 0 };
+    richtext::columnar_table const* columnar{ nullptr };
+
+    void on_flat_node_begin(richtext::flat_document const& document, richtext::flat_document::index_type i) {
+      kinds.push_back(document.kind(i));
+      ++open;
+    }
+
+    void on_flat_node_end(richtext::flat_document const&, richtext::flat_document::index_type) { --open; }
+    void on_columnar_table_begin(richtext::columnar_table const& table) { columnar = &table; }
+  };
+
+}
+
+
+TEST_CASE("flat document") {
+
+  using namespace richtext;
+  auto const tree = document{ "Document Header" }
+    .add(paragraph{}
+      .add("This ")
+      .add(tag::strong, "is")
+      .add(" ")
+      .add(tag::emphasis, "formatted"))
+    .add(section{ "Section Header" }
+      .add(unordered_list{ "Unordered items:" }
+        .add(paragraph{ "Item 1" })
+        .add(ordered_list{}
+          .add(paragraph{ "Nested" }))))
+    .add(subsection{ "Subsection Header" }
+      .add(table{ {"Column A", "Column B"} }
+        .add(table_row{}.add("1").add("2"))
+        .add(table_row{}.add("3"))
+        .add(table_row{}.add("long_cell").add(tag::strong, "4"))));
+
+  auto const flat = flat_document::builder{ "Document Header" }
+    .paragraph()
+      .add("This ")
+      .add(tag::strong, "is")
+      .add(" ")
+      .add(tag::emphasis, "formatted")
+    .section("Section Header")
+      .unordered_list("Unordered items:")
+        .paragraph().add("Item 1").end()
+        .ordered_list()
+          .paragraph().add("Nested")
+    .subsection("Subsection Header")
+      .add("ignored")
+      .table({"Column A", "Column B"})
+        .row().add("1").add("2")
+        .row().add("3")
+        .row().add("long_cell").add(tag::strong, "4")
+    .build();
+
+  REQUIRE(flat.kind(flat_document::root) == node_kind::document);
+  REQUIRE(flat.blob().find("ignored") == std::string_view::npos);
+  REQUIRE(flat.blob().find("3") == std::string_view::npos);
+
+  formatters::markdown expected, md;
+  expected.render(tree);
+  md.render(flat);
+  REQUIRE(std::string_view{md.data(), md.size()} == std::string_view{expected.data(), expected.size()});
+
+  node_recorder recorder;
+  recorder.render(flat);
+  REQUIRE(recorder.open == 0);
+  REQUIRE(recorder.kinds.front() == node_kind::document);
+  auto const count = [&](node_kind kind) {
+    return std::count(recorder.kinds.begin(), recorder.kinds.end(), kind);
+  };
+  REQUIRE(count(node_kind::paragraph) == 3);
+  REQUIRE(count(node_kind::table_header) == 1);
+  REQUIRE(count(node_kind::table_row) == 2);
+}
+
+
+TEST_CASE("compact span") {
+
+  using namespace richtext;
+  static_assert(sizeof(span) == 24);
+
+  std::string const short_text(span::inline_capacity, 's');
+  std::string const long_text(span::inline_capacity + 1, 'l');
+
+  span const a{ tag::strong_emphasis, short_text };
+  REQUIRE(a.tag() == tag::strong_emphasis);
+  REQUIRE(a.text() == short_text);
+  REQUIRE(a.text().data() != short_text.data());
+  REQUIRE(!a.borrowed());
+
+  span b{ tag::emphasis, long_text };
+  REQUIRE(b.tag() == tag::emphasis);
+  REQUIRE(b.length() == long_text.size());
+  REQUIRE(b.text() == long_text);
+
+  span c{ std::move(b) };
+  REQUIRE(c.text() == long_text);
+  REQUIRE(b.empty());
+  REQUIRE(b.tag() == tag::normal);
+
+  std::pmr::monotonic_buffer_resource resource;
+  std::pmr::vector<span> spans{ &resource };
+  spans.push_back(std::move(c));
+  spans.emplace_back(tag::strong, long_text);
+  REQUIRE(spans[0].text() == long_text);
+  REQUIRE(spans[0].tag() == tag::emphasis);
+  REQUIRE(spans[1].tag() == tag::strong);
+
+  c = span::ref(tag::strong, long_text);
+  REQUIRE(c.borrowed());
+  REQUIRE(c.tag() == tag::strong);
+  REQUIRE(c.text().data() == long_text.data());
+
+  // a long string moved in keeps its buffer, also through a move to another resource
+  std::string owned = long_text;
+  char const* const buffer = owned.data();
+  spans.push_back(span{ tag::strong, std::move(owned) });
+  REQUIRE(spans.back().text().data() == buffer);
+  REQUIRE(spans.back().tag() == tag::strong);
+  auto const row = table_row{}.add(std::string(long_text)).add(std::string("short"));
+  REQUIRE(row.at(0).text() == long_text);
+  REQUIRE(row.at(1).text() == "short");
+}
+
+
+TEST_CASE("numeric cells") {
+
+  using namespace richtext;
+  uformat::small_texter t;
+  t.fixed(1.05, 2).print(' ').fixed(0.999, 2).print(' ').fixed(2.5, 0).print(' ')
+   << std::numeric_limits<std::int64_t>::min() << ' ' << std::numeric_limits<std::uint64_t>::max();
+  REQUIRE(t.string() == "1.05 1.00 3 -9223372036854775808 18446744073709551615");
+
+  auto const cell = span{ tag::strong, -1234.5678, 2 };
+  REQUIRE(cell.kind() == value_kind::floating);
+  REQUIRE(cell.length() == 8);
+  REQUIRE(cell.text().empty());
+  REQUIRE(span{ tag::normal, std::uint64_t(42) }.length() == 2);
+  REQUIRE(span{ tag::normal, std::numeric_limits<std::int64_t>::min() }.length() == 20);
+  auto moved = span{ tag::normal, 0.5, 3 };
+  REQUIRE(span{ std::move(moved) }.length() == 5);
+  REQUIRE(span{ tag::normal, std::numeric_limits<std::int64_t>::min() }.integer()
+          == std::numeric_limits<std::int64_t>::min());
+  REQUIRE(span{ tag::normal, std::numeric_limits<std::uint64_t>::max() }.unsigned_integer()
+          == std::numeric_limits<std::uint64_t>::max());
+  REQUIRE(span{ tag::normal, std::int64_t(-7) }.precision() == 0);
+  auto const copy = span::borrow(cell);
+  REQUIRE(copy.floating() == -1234.5678);
+  REQUIRE(copy.length() == 8);
+  REQUIRE(copy.fingerprint() == cell.fingerprint());
+  REQUIRE(span::borrow(span{ tag::normal, std::int64_t(-7) }).integer() == -7);
+
+  // digits past the inline room are formatted again and print the same
+  uformat::small_texter short_digits, long_digits;
+  span{ tag::normal, 12345678.125, 3 }.print(short_digits);
+  span{ tag::normal, -123456789012.5, 16 }.print(long_digits);
+  REQUIRE(short_digits.string() == "12345678.125");
+  REQUIRE(long_digits.string() == "-123456789012.5000000000000000");
+  REQUIRE(span{ tag::normal, -123456789012.5, 16 }.length() == long_digits.string().size());
+
+  formatters::markdown numbers, strings;
+  numbers.render(document{}.add(table{ {"Name", "Count", "Total", "Ratio"} }
+    .add(table_row{}.add("a").add(7).add(std::uint64_t(1234567890123)).add(0.125, 3))
+    .add(table_row{}.add("b").add(-42).add(0u).add(tag::strong, 10.0, 1))));
+  strings.render(document{}.add(table{ {"Name", "Count", "Total", "Ratio"} }
+    .add(table_row{}.add("a").add("7").add("1234567890123").add("0.125"))
+    .add(table_row{}.add("b").add("-42").add("0").add(tag::strong, "10.0"))));
+  REQUIRE(std::string_view{numbers.data(), numbers.size()} == std::string_view{strings.data(), strings.size()});
+}
+
+
+TEST_CASE("columnar table") {
+
+  using namespace richtext;
+  std::int64_t const ids[] = { 1, std::numeric_limits<std::int64_t>::min(), 300 };
+  std::uint64_t const too_short[] = { 1, 2 };
+  std::string_view const statuses[] = { "ok", "failed" };
+  std::uint32_t const out_of_range[] = { 0, 2, 1 };
+  std::uint32_t const codes[] = { 0, 1, 0 };
+  double const odd[] = { std::numeric_limits<double>::quiet_NaN(), -std::numeric_limits<double>::infinity(), 0.5 };
+
+  auto columns = columnar_table{}
+    .add_column("Id", ids)
+    .add_column("Short", too_short)
+    .add_dictionary_column("Bad", statuses, 2, out_of_range, 3)
+    .add_dictionary_column("Status", statuses, 2, codes, 3)
+    .add_column("Odd", odd, 1);
+  REQUIRE(columns.columns_count() == 3);
+  REQUIRE(columns.rows_count() == 3);
+  REQUIRE(columns.header()[1] == "Status");
+  REQUIRE(columns.at(0).stats().width == 20);
+  REQUIRE(columns.at(1).dictionary());
+  REQUIRE(columns.at(1).stats().width == 6);
+  // non-finite values are measured as printed but stay out of the range
+  REQUIRE(columns.at(2).stats().width == 3);
+  REQUIRE(columns.at(2).stats().min == 0.5);
+  REQUIRE(columns.at(2).stats().max == 0.5);
+
+  // a value inside the range can be the widest when the ends have exponents
+  double const wide[] = { 0.0, 1e19, 1e300 };
+  double const negative[] = { -1e300, -1e19, 0.0 };
+  auto const crossing = columnar_table{}.add_column("Wide", wide, 2).add_column("Negative", negative, 2);
+  REQUIRE(crossing.at(0).stats().width == std::string_view{ "10000000000000000000.00" }.size());
+  REQUIRE(crossing.at(1).stats().width == std::string_view{ "-10000000000000000000.00" }.size());
+
+  auto const doc = document{}.add(std::move(columns));
+  formatters::markdown md;
+  md.render(doc);
+  std::string_view const out{ md.data(), md.size() };
+  REQUIRE(out.find("| -9223372036854775808 | failed | INF |") != std::string_view::npos);
+  REQUIRE(out.find("| 300                  |     ok | 0.5 |") != std::string_view::npos);
+
+  node_recorder recorder;
+  recorder.render(doc);
+  REQUIRE(recorder.columnar == doc.begin()->columnar_table());
+
+  // no rows leaves the header, no columns leaves nothing to render
+  formatters::markdown empty;
+  empty.render(document{}.add(columnar_table{}.add_column("Empty", std::vector<double>{}, 2)));
+  REQUIRE(std::string_view{ empty.data(), empty.size() } == "| Empty |\n|:------|\n\n");
+  empty.clear();
+  empty.render(document{}.add(columnar_table{}));
+  REQUIRE(empty.size() == 1);
+}
+
+
+TEST_CASE("lazy table") {
+
+  using namespace richtext;
+  // every call to the source starts the rows over
+  int started = 0;
+  auto const source = [&started](std::vector<std::string_view> cells) {
+    return [&started, cells] {
+      ++started;
+      return lazy_table::generator_type{ [&cells, n = std::size_t(0)](table_row& row) mutable {
+        if (n == cells.size())
+          return false;
+        if (cells[n] != "mismatched")
+          row.add(n + 1);
+        row.add(cells[n++]);
+        return true;
+      } };
+    };
+  };
+  auto const render = [](lazy_table&& table) {
+    formatters::markdown md;
+    md.render(document{}.add(std::move(table)));
+    return std::string{ md.data(), md.size() };
+  };
+
+  // rendered twice, the generator restarts rather than resuming
+  auto const doc = document{}.add(lazy_table{ {"N", "Text"}, source({ "a", "bb" }) });
+  formatters::markdown md;
+  md.render(doc);
+  std::string const first{ md.data(), md.size() };
+  md.clear();
+  md.render(doc);
+  REQUIRE(started == 2);
+  REQUIRE(std::string_view{ md.data(), md.size() } == first);
+  REQUIRE(first.find("| 2 |   bb |") != std::string::npos);
+
+  // no source and a source with no rows both leave the bare header
+  auto const bare = render(lazy_table{ {"N", "Text"}, lazy_table::source_type{} });
+  REQUIRE(bare == render(lazy_table{ {"N", "Text"}, source({}) }));
+  REQUIRE(bare == "| N | Text |\n|:--|-----:|\n\n");
+
+  // rows of another width are skipped inside the sample and after it
+  auto const skipped = render(lazy_table{ {"N", "Text"}, source({ "mismatched", "a", "mismatched", "b" }) }
+    .sample_size(1));
+  REQUIRE(skipped.find("mismatched") == std::string::npos);
+  REQUIRE(skipped.find("| 2 |    a |\n| 4 |    b |") != std::string::npos);
+
+  // given widths are never narrower than the header, a wrong count is ignored
+  auto const given = lazy_table{ {"N", "Text"}, source({ "a" }) }.widths({ 0, 0 });
+  REQUIRE(given.widths() == lazy_table::widths_type{ 0, 0 });
+  REQUIRE(render(lazy_table{ {"N", "Text"}, source({ "a" }) }.widths({ 0, 0 }))
+          == render(lazy_table{ {"N", "Text"}, source({ "a" }) }));
+  REQUIRE(lazy_table{ {"N", "Text"}, source({ "a" }) }.widths({ 3 }).widths().empty());
+
+  // without a sample, cells wider than the header overflow instead of being cut
+  auto const unsampled = render(lazy_table{ {"N", "Text"}, source({ "the widest cell" }) }.sample_size(0));
+  REQUIRE(unsampled.find("| 1 | the widest cell |") != std::string::npos);
+  REQUIRE(unsampled.find("|:--|-----:|") != std::string::npos);
+
+  // a generator may point every row into the same buffer
+  auto const reused = [] {
+    return lazy_table::generator_type{ [line = std::string{}, n = 0](table_row& row) mutable {
+      if (n == 3)
+        return false;
+      line = "line-" + std::to_string(n++);
+      row.add_ref(line);
+      return true;
+    } };
+  };
+  auto const lines = render(lazy_table{ {"Line"}, reused }.sample_size(2));
+  REQUIRE(lines.find("| line-0 |\n| line-1 |\n| line-2 |") != std::string::npos);
+
+  // a range is read again on every render, changes to it included
+  std::vector<table_row> rows;
+  rows.push_back(table_row{}.add(1).add("x"));
+  auto const ranged = document{}.add(lazy_table{ {"N", "Text"}, rows.cbegin(), rows.cend() });
+  md.clear();
+  md.render(ranged);
+  REQUIRE(std::string_view{ md.data(), md.size() }.find("| 1 |    x |") != std::string_view::npos);
+  rows.front().set(1, span{ "changed" });
+  md.clear();
+  md.render(ranged);
+  REQUIRE(std::string_view{ md.data(), md.size() }.find("| 1 | changed |") != std::string_view::npos);
+}
+
+
+TEST_CASE("streaming writer") {
+
+  using namespace richtext;
+  formatters::markdown md;
+  REQUIRE_THROWS_AS(writer(md, writer::sink_type{}), std::invalid_argument);
+
+  std::vector<std::string> chunks;
+  auto const collect = [&chunks](std::string_view chunk) { chunks.emplace_back(chunk); };
+  auto const joined = [&chunks] {
+    std::string all;
+    for (auto const& chunk: chunks)
+      all += chunk;
+    return all;
+  };
+
+  // below the threshold everything goes out at once when finished
+  {
+    writer w{ md, collect };
+    w.paragraph("one").paragraph("two");
+    REQUIRE(chunks.empty());
+    w.finish();
+    REQUIRE(chunks.size() == 1);
+    w.finish();
+    w.paragraph("after");
+    REQUIRE(chunks.size() == 1);
+  }
+  REQUIRE(chunks.size() == 1);
+  REQUIRE(md.size() == 0);
+
+  // a zero threshold hands every finished node over on its own
+  chunks.clear();
+  writer{ md, collect, {}, 0 }.paragraph("one").paragraph("two");
+  REQUIRE(chunks.size() == 2);
+  REQUIRE(chunks[0] == "one\n\n");
+
+  // rows outside a table, after it or of the wrong width are ignored,
+  // ends of nodes that aren't open too
+  chunks.clear();
+  {
+    writer w{ md, collect };
+    w.row(table_row{}.add("stray"))
+      .end_section()
+      .end_table()
+      .begin_table({"Id", "Event"})
+        .row(table_row{}.add("mismatched"))
+        .row(table_row{}.add(1).add("login"))
+      .end_table()
+      .row(table_row{}.add(2).add("late"));
+    w.finish();
+    w.row(table_row{}.add(3).add("finished"));
+  }
+  auto const rows = joined();
+  REQUIRE(rows.find("stray") == std::string::npos);
+  REQUIRE(rows.find("mismatched") == std::string::npos);
+  REQUIRE(rows.find("late") == std::string::npos);
+  REQUIRE(rows.find("finished") == std::string::npos);
+  REQUIRE(rows.find("| 1  | login |") != std::string::npos);
+
+  // a node that can't nest closes what it can't go into
+  chunks.clear();
+  {
+    writer w{ md, collect };
+    w.begin_section("First")
+      .begin_unordered_list()
+        .paragraph("item")
+        .begin_section("Second")
+          .paragraph("text");
+  }
+  formatters::markdown closed;
+  closed.render(document{}
+    .add(section{ "First" }.add(unordered_list{}.add(paragraph{ "item" })))
+    .add(section{ "Second" }.add(paragraph{ "text" })));
+  REQUIRE(joined() == std::string_view{ closed.data(), closed.size() });
+
+  // a full sample prints the header, later rows keep its widths
+  chunks.clear();
+  {
+    writer w{ md, collect, {}, 0 };
+    w.begin_table({"N"}, {}, 1)
+      .row(table_row{}.add(7));
+    REQUIRE(joined() == "| N |\n|:--|\n| 7 |\n");
+    w.row(table_row{}.add(12345));
+  }
+  REQUIRE(joined().find("| 12345 |") != std::string::npos);
+
+  // held rows don't point at a buffer reused for every row
+  chunks.clear();
+  {
+    writer w{ md, collect };
+    w.begin_table({"Line"});
+    std::string line;
+    for (int i = 0; i != 3; ++i) {
+      line = "line-" + std::to_string(i);
+      w.row(table_row{}.add_ref(tag::normal, line));
+    }
+  }
+  REQUIRE(joined().find("| line-0 |\n| line-1 |\n| line-2 |") != std::string::npos);
+
+  // finish() reports a failing sink once, the destructor swallows it
+  int failures = 0;
+  auto const failing = [&failures](std::string_view) {
+    ++failures;
+    throw std::runtime_error{ "disk full" };
+  };
+  {
+    writer w{ md, failing };
+    w.paragraph("lost");
+    REQUIRE_THROWS_AS(w.finish(), std::runtime_error);
+    REQUIRE_NOTHROW(w.finish());
+  }
+  REQUIRE(failures == 1);
+  md.clear();
+  {
+    writer w{ md, failing };
+    w.paragraph("lost");
+  }
+  REQUIRE(failures == 2);
+}
+
+
+TEST_CASE("shared section") {
+
+  using namespace richtext;
+  auto const build = [] {
+    return section{ "Legal" }
+      .add(paragraph{}.add(tag::strong, "Terms").add(" apply"))
+      .add(table{ {"Key", "Value"} }.add(table_row{}.add("id").add(42)));
+  };
+
+  formatters::markdown expected;
+  expected.render(document{ "Report" }.add(build()).add(section{ "End" }));
+
+  auto const legal = std::make_shared<section const>(build());
+  auto const report = document{ "Report" }.add(legal).add(section{ "End" });
+  REQUIRE(report.begin()->kind() == fragment_kind::section);
+  REQUIRE(report.begin()->section() == legal.get());
+
+  formatters::markdown md;
+  md.cache_shared(true);
+  for (int i = 0; i != 2; ++i) {
+    md.clear();
+    md.render(report);
+    REQUIRE(std::string_view{md.data(), md.size()} ==
+            std::string_view{expected.data(), expected.size()});
+  }
+
+  // sections that are gone don't pile up
+  for (int i = 0; i != 1000; ++i) {
+    md.clear();
+    md.render(document{ "Report" }.add(std::make_shared<section const>(build())));
+  }
+  REQUIRE(md.shared_entries() <= 32);
+}
+
+
+namespace {
+
+  // fails the first paragraph it ends
+  struct throwing_markdown: richtext::formatters::markdown {
+    bool armed{ true };
+
+    void on_paragraph_end(richtext::paragraph const& paragraph) override {
+      if (armed) {
+        armed = false;
+        throw std::runtime_error{ "hook failed" };
+      }
+      markdown::on_paragraph_end(paragraph);
+    }
+  };
+
+}
+
+
+TEST_CASE("document template") {
+
+  using namespace richtext;
+  auto const build = [] {
+    return document{ "Invoice" }
+      .add(paragraph{}.add("Dear ").add_slot(tag::strong, "name").add(", you owe ").add_slot("total"))
+      .add(table{ {"Item", "Sum"} }
+        .add(table_row{}.add("fee").add(3))
+        .add(table_row{}.add("total").add_slot("total")));
+  };
+  auto const output = [](formatters::markdown const& md) { return std::string{ md.data(), md.size() }; };
+  auto constexpr npos = std::string::npos;
+
+  formatters::markdown md;
+  document_template invoice{ md, build() };
+  REQUIRE(md.size() == 0);
+  REQUIRE(invoice.slots_count() == 2);
+  REQUIRE(invoice.find("name") == 0);
+  REQUIRE(invoice.name(1) == "total");
+  REQUIRE(invoice.find("missing") == document_template::npos);
+  REQUIRE(invoice.name(2).empty());
+
+  // unknown names and slots out of range change nothing
+  invoice.set(0, "Ann_Lee").set("total", 1234567)
+    .set("missing", 1).set(2, "ignored").set(2, 1).set(2, 0.5, 1);
+  invoice.render();
+  REQUIRE(output(md).find("Dear **Ann\\_Lee**, you owe 1234567\n") != npos);
+  REQUIRE(output(md).find("| total | 1234567 |") != npos);
+  REQUIRE(output(md).find("ignored") == npos);
+
+  // tables holding a slot are measured again with every value
+  md.clear();
+  invoice.set("total", 1);
+  invoice.render();
+  REQUIRE(output(md).find("| total |   1 |") != npos);
+  REQUIRE(output(md).find("you owe 1\n") != npos);
+
+  // a failed compile leaves the formatter usable as if it never began
+  throwing_markdown failing;
+  REQUIRE_THROWS_AS(document_template(failing, build()), std::runtime_error);
+  failing.clear();
+  failing.render(document{}.add(table{ {"Slot"} }.add(table_row{}.add_slot("x"))));
+  REQUIRE(output(failing).find("| Slot |") != npos);
+}
+
+
+TEST_CASE("in-place mutation") {
+
+  using namespace richtext;
+  auto const build = [](int status, std::string_view note, bool stale) {
+    auto table = richtext::table{ {"Service", "Status"} }
+      .add(table_row{}.add("api").add(status))
+      .add(table_row{}.add("db").add("ok"));
+    if (stale)
+      table.add(table_row{}.add("legacy").add("down"));
+    return document{ "Dashboard" }
+      .add(section{ "Services" }
+        .add(paragraph{}.add("Updated ").add(tag::strong, note))
+        .add(std::move(table)));
+  };
+
+  auto dashboard = build(200, "just now", true);
+  auto& services = *dashboard.at(0).section();
+  auto& note = *services.at(0).paragraph();
+  auto& status = *services.at(1).table();
+
+  REQUIRE(note.replace(1, span{ tag::strong, "a second ago, the longest note so far" }));
+  REQUIRE(note.text().length() == 8 + 37);
+  REQUIRE(note.replace(1, span{ tag::strong, "1s ago" }));
+  REQUIRE(note.text().length() == 8 + 6);
+  REQUIRE(status.set_cell(0, 1, span{ tag::normal, std::int64_t(503) }));
+  REQUIRE(status.remove(2));
+  REQUIRE(status.rows_count() == 2);
+
+  // positions out of range change nothing
+  auto const revision = dashboard.revision();
+  REQUIRE_FALSE(note.replace(2, span{ "out of range" }));
+  REQUIRE_FALSE(note.remove(2));
+  REQUIRE_FALSE(status.set_cell(0, 2, span{ "out of range" }));
+  REQUIRE_FALSE(status.set_cell(2, 0, span{ "out of range" }));
+  REQUIRE_FALSE(status.remove(2));
+  REQUIRE_FALSE(services.remove(2));
+  REQUIRE_FALSE(dashboard.remove(1));
+  REQUIRE(note.text().length() == 8 + 6);
+  REQUIRE(dashboard.revision() == revision);
+  auto row = table_row{}.add("a");
+  REQUIRE_FALSE(row.set(1, span{ "b" }));
+  REQUIRE(row.set(0, span{ "b" }));
+  REQUIRE(row.at(0).text() == "b");
+
+  formatters::markdown expected;
+  expected.render(build(503, "1s ago", false));
+  formatters::markdown md;
+  md.render(dashboard);
+  REQUIRE(std::string_view{md.data(), md.size()} ==
+          std::string_view{expected.data(), expected.size()});
+
+  note.replace_text(text{}.add("Paused"));
+  REQUIRE(note.remove(0));
+  REQUIRE(note.text().empty());
+  REQUIRE(note.text().length() == 0);
+  REQUIRE(dashboard.remove(0));
+  REQUIRE(dashboard.size() == 0);
+
+  // ids keep naming the same item when earlier ones are removed
+  row_id first, second, skipped;
+  auto ids = richtext::table{ {"Service"} }
+    .add(table_row{}.add("api"), first)
+    .add(table_row{}.add("db"), second)
+    .add(table_row{}.add("too").add("wide"), skipped);
+  REQUIRE(skipped == row_id{});
+  REQUIRE(ids.remove(first));
+  REQUIRE_FALSE(ids.remove(first));
+  REQUIRE(ids.find(first) == nullptr);
+  REQUIRE(ids.find(second) == &ids.at(0));
+  REQUIRE(ids.set_cell(second, 0, span{ "cache" }));
+  REQUIRE(ids.at(0).at(0).text() == "cache");
+  REQUIRE_FALSE(ids.set_cell(second, 1, span{ "out of range" }));
+  REQUIRE_FALSE(ids.set_cell(row_id{}, 0, span{ "nothing" }));
+
+  node_id intro, body, none;
+  dashboard.add(paragraph{ "intro" }, intro)
+    .add(section{ "Body" }, body)
+    .add(std::shared_ptr<section const>{}, none);
+  REQUIRE(none == node_id{});
+  REQUIRE(dashboard.size() == 2);
+  REQUIRE(dashboard.remove(intro));
+  REQUIRE(dashboard.find(intro) == nullptr);
+  REQUIRE(dashboard.find(body) == &dashboard.at(0));
+  node_id nested;
+  dashboard.find(body)->section()->add(paragraph{ "nested" }, nested);
+  REQUIRE(dashboard.at(0).section()->find(nested)->paragraph() != nullptr);
+  REQUIRE(dashboard.remove(body));
+  REQUIRE(dashboard.size() == 0);
+}
+
+
+TEST_CASE("static markdown") {
+
+  using namespace richtext;
+  auto const build = [] {
+    return document{ "Report" }
+      .add(paragraph{}.add("Plain ").add(tag::emphasis, "and_escaped"))
+      .add(section{ "Numbers" }
+        .add(table{ {"Id", "Value"} }
+          .add(table_row{}.add(1).add(2.5, 2))
+          .add(table_row{}.add("two").add(tag::strong, "x")))
+        .add(subsection{ "List" }
+          .add(ordered_list{}.add(paragraph{ "one" })
+            .add(unordered_list{}.add(paragraph{ "nested" })))));
+  };
+
+  formatters::markdown dynamic;
+  dynamic.render(build());
+  formatters::static_markdown md{ formatters::markdown_options{} };
+  md.render(build());
+  REQUIRE(std::string_view{md.data(), md.size()} ==
+          std::string_view{dynamic.data(), dynamic.size()});
+}
+
+
+namespace {
+
+  struct depth_counter final: richtext::basic_formatter<depth_counter> {
+    std::size_t depth{ 0 }, deepest{ 0 }, items{ 0 };
+
+    void on_unordered_list_begin(richtext::unordered_list const&) {
+      deepest = std::max(deepest, ++depth);
+    }
+
+    void on_ordered_list_begin(richtext::ordered_list const&) {
+      deepest = std::max(deepest, ++depth);
+    }
+
+    void on_unordered_list_end(richtext::unordered_list const&) { --depth; }
+    void on_ordered_list_end(richtext::ordered_list const&) { --depth; }
+    void on_unordered_list_item_end(richtext::list_item const&) { ++items; }
+    void on_ordered_list_item_end(std::size_t, richtext::list_item const&) { ++items; }
+  };
+
+}
+
+
+TEST_CASE("deeply nested lists") {
+
+  using namespace richtext;
+  std::size_t const levels = 100000;
+  auto const build = [levels] {
+    auto list = unordered_list{}.add(paragraph{ "leaf" });
+    for (std::size_t i = 1; i != levels; ++i) {
+      if (i % 2 == 0)
+        list = unordered_list{}.add(paragraph{ "level" }).add(std::move(list));
+      else
+        list = unordered_list{}.add(ordered_list{}.add(std::move(list)).add(paragraph{ "after" }));
+    }
+    return list;
+  };
+  // odd steps add two levels and three items, even steps one and two
+  std::size_t const odd = levels / 2, even = (levels - 1) / 2;
+
+  auto const doc = document{}.add(build());
+  depth_counter counter;
+  counter.render(doc);
+  REQUIRE(counter.depth == 0);
+  REQUIRE(counter.deepest == 1 + 2 * odd + even);
+  REQUIRE(counter.items == 1 + 3 * odd + 2 * even);
+
+  // moving into the arena's allocator takes every level along
+  pmr::arena arena;
+  {
+    auto const in_arena = document{ arena.allocator() }.add(build());
+    depth_counter arena_counter;
+    arena_counter.render(in_arena);
+    REQUIRE(arena_counter.deepest == counter.deepest);
+    REQUIRE(arena_counter.items == counter.items);
+  }
+
+  // every level holds a paragraph and the next list
+  flat_document::builder builder;
+  for (std::size_t i = 0; i != levels; ++i) {
+    if (i % 2 == 0)
+      builder.unordered_list();
+    else
+      builder.ordered_list();
+    builder.paragraph().add("level");
+  }
+  auto const flat = builder.build();
+  depth_counter flat_counter;
+  flat_counter.render(flat);
+  REQUIRE(flat_counter.depth == 0);
+  REQUIRE(flat_counter.deepest == levels);
+  REQUIRE(flat_counter.items == 2 * levels - 1);
+}
+
+
+TEST_CASE("parallel render") {
+
+  using namespace richtext;
+  auto doc = document{ "Report" }.add(paragraph{ "Summary" });
+  for (int i = 0; i != 40; ++i) {
+    auto part = section{ "Part " + std::to_string(i) };
+    auto table = richtext::table{ {"Id", "Value"} };
+    for (int r = 0; r <= i; ++r)
+      table.add(table_row{}.add(r).add(std::string(std::size_t(r % 7), 'x')));
+    part.add(std::move(table))
+      .add(subsection{ "Notes" }
+        .add(unordered_list{}.add(paragraph{ "first" })
+          .add(ordered_list{}.add(paragraph{ "nested" }))));
+    doc.add(std::move(part));
+  }
+
+  formatters::markdown expected;
+  expected.render(doc);
+  for (std::size_t threads: {1, 2, 3, 8, 100}) {
+    formatters::markdown md;
+    md.render(doc, threads, [] { return std::make_unique<formatters::markdown>(); });
+    REQUIRE(std::string_view{md.data(), md.size()} ==
+            std::string_view{expected.data(), expected.size()});
+  }
+
+  formatters::static_markdown fixed;
+  fixed.render(doc, 4, [] { return std::make_unique<formatters::static_markdown>(); });
+  REQUIRE(std::string_view{fixed.data(), fixed.size()} ==
+          std::string_view{expected.data(), expected.size()});
+
+  // workers and their threads are kept for the next document
+  formatters::markdown reused;
+  std::size_t made = 0;
+  for (std::size_t threads: {3, 3, 2, 5}) {
+    reused.clear();
+    reused.render(doc, threads, [&made] { ++made; return std::make_unique<formatters::markdown>(); });
+    REQUIRE(std::string_view{reused.data(), reused.size()} ==
+            std::string_view{expected.data(), expected.size()});
+  }
+  REQUIRE(made == 5);
+}
+
+
+TEST_CASE("render cache") {
+
+  using namespace richtext;
+  auto const build = [](int run) {
+    auto doc = document{ "Report" }
+      .add(section{ "Header" }.add(paragraph{}.add("Run ").add(tag::strong, std::to_string(run))));
+    for (int i = 0; i != 5; ++i)
+      doc.add(section{ "Part " + std::to_string(i) }
+        .add(table{ {"Id", "Value"} }.add(table_row{}.add(i).add("value")))
+        .add(subsection{ "Notes" }
+          .add(unordered_list{}.add(paragraph{ "note" })
+            .add(ordered_list{}.add(paragraph{ "nested" })))));
+    return doc;
+  };
+  auto const same = [](auto const& x, auto const& y) {
+    return std::string_view{x.data(), x.size()} == std::string_view{y.data(), y.size()};
+  };
+
+  formatters::markdown md;
+  md.cache_budget(1 << 20);
+  md.render(build(1));
+  auto const first = md.cache_stats();
+  // the notes are the same in every part
+  REQUIRE(first.hits == 4);
+  REQUIRE(first.entries == first.misses);
+
+  // only the header section differs from the first run
+  md.clear();
+  auto doc = build(2);
+  md.render(doc);
+  formatters::markdown expected;
+  expected.render(build(2));
+  REQUIRE(same(md, expected));
+  REQUIRE(md.cache_stats().hits == first.hits + 5);
+  REQUIRE(md.cache_stats().misses == first.misses + 1);
+
+  // a changed cell misses the section and the table, the notes still hit
+  REQUIRE(doc.at(3).section()->at(0).table()->set_cell(0, 1, span{ "changed" }));
+  auto const before = md.cache_stats();
+  md.clear();
+  md.render(doc);
+  expected.clear();
+  expected.render(doc);
+  REQUIRE(same(md, expected));
+  REQUIRE(md.cache_stats().misses == before.misses + 2);
+  REQUIRE(md.cache_stats().hits == before.hits + 5 + 1);
+
+  md.cache_budget(200);
+  REQUIRE(md.cache_stats().bytes <= 200);
+  REQUIRE(md.cache_stats().evictions > 0);
+  md.clear();
+  md.render(doc);
+  REQUIRE(same(md, expected));
+  REQUIRE(md.cache_stats().bytes <= 200);
+  md.cache_budget(0);
+  REQUIRE(md.cache_stats().entries == 0);
+
+  // formatters caching the same nodes at once fingerprint them together
+  auto const shared = build(3);
+  std::string outputs[2];
+  std::thread threads[2];
+  std::atomic<int> ready{ 0 };
+  for (int t = 0; t != 2; ++t)
+    threads[t] = std::thread{ [&shared, &outputs, &ready, t] {
+      formatters::markdown cached;
+      cached.cache_budget(1 << 20);
+      ready.fetch_add(1);
+      while (ready.load() != 2)
+        std::this_thread::yield();
+      cached.render(shared);
+      outputs[t].assign(cached.data(), cached.size());
+    } };
+  for (auto& thread: threads)
+    thread.join();
+  expected.clear();
+  expected.render(shared);
+  REQUIRE(outputs[0] == std::string_view{expected.data(), expected.size()});
+  REQUIRE(outputs[1] == outputs[0]);
+
+  // borrowed text may change between renders, so nothing holding it is cached
+  std::string buffer = "alpha";
+  auto const borrowing = document{}
+    .add(section{ "Text" }.add(paragraph{}.add_ref(buffer)))
+    .add(section{ "Table" }.add(richtext::table{ {"Cell"} }.add(table_row{}.add_ref(buffer))))
+    .add(section{ "List" }.add(unordered_list{}.add(paragraph{}.add_ref(buffer))));
+  formatters::markdown borrowed;
+  borrowed.cache_budget(1 << 20);
+  borrowed.render(borrowing);
+  buffer = "omega";
+  borrowed.clear();
+  borrowed.render(borrowing);
+  expected.clear();
+  expected.render(borrowing);
+  REQUIRE(same(borrowed, expected));
+  REQUIRE(std::string_view{borrowed.data(), borrowed.size()}.find("alpha") == std::string_view::npos);
+  REQUIRE(borrowed.cache_stats().entries == 0);
+  text const pointing = text{}.add("owned").add_ref(buffer);
+  auto const print = pointing.fingerprint();
+  buffer = "delta";
+  REQUIRE(pointing.fingerprint() != print);
+
+  // moved into another allocator, the source is left empty with a new revision
+  pmr::arena arena;
+  text source{ "hello world" };
+  auto const revision = source.revision();
+  text const moved{ std::move(source), arena.allocator() };
+  REQUIRE(moved.length() == 11);
+  REQUIRE(moved.revision() == revision);
+  REQUIRE(source.length() == 0);
+  REQUIRE(source.revision() != revision);
+  source.add("x");
+  REQUIRE(source.length() == 1);
+  auto rows = richtext::table{ {"A"} }.add(table_row{}.add("a"));
+  auto const table_revision = rows.revision();
+  richtext::table const moved_rows{ std::move(rows), arena.allocator() };
+  REQUIRE(moved_rows.rows_count() == 1);
+  REQUIRE(rows.rows_count() == 0);
+  REQUIRE(rows.revision() != table_revision);
+  auto part = section{ "Part" }.add(paragraph{ "text" });
+  auto const section_revision = part.revision();
+  section const moved_part{ std::move(part), arena.allocator() };
+  REQUIRE(part.size() == 0);
+  REQUIRE(part.header().empty());
+  REQUIRE(part.revision() != section_revision);
+  auto items = unordered_list{ "List" }.add(paragraph{ "item" });
+  auto const list_revision = items.revision();
+  unordered_list const moved_items{ std::move(items), arena.allocator() };
+  REQUIRE(items.empty());
+  REQUIRE(items.revision() != list_revision);
+}
+
+
+TEST_CASE("live output") {
+
+  using namespace richtext;
+  auto const part = [](int i, std::string_view value) {
+    return section{ "Part " + std::to_string(i) }
+      .add(paragraph{ "Summary" })
+      .add(subsection{ "Details" }.add(table{ {"Id", "Value"} }.add(table_row{}.add(i).add(value))));
+  };
+  auto doc = document{ "Dashboard" };
+  for (int i = 0; i != 4; ++i)
+    doc.add(part(i, "value"));
+  auto const full = [](document const& doc) {
+    formatters::markdown md;
+    md.render(doc);
+    return std::string{ md.data(), md.size() };
+  };
+
+  formatters::markdown md;
+  live_output live{ md, doc };
+  REQUIRE(live.refresh() == 4);
+  REQUIRE(live.string() == full(doc));
+  REQUIRE(live.size() == live.string().size());
+  REQUIRE(live.refresh() == 0);
+
+  auto& changed = *doc.at(2).section();
+  REQUIRE(changed.at(1).subsection()->at(0).table()->set_cell(0, 1, span{ "changed" }));
+  REQUIRE(live.refresh() == 1);
+  REQUIRE(live.string() == full(doc));
+
+  // a rejected change isn't one
+  REQUIRE_FALSE(changed.at(0).paragraph()->remove(1));
+  REQUIRE(live.refresh() == 0);
+
+  // assigning over a node counts as a change as well
+  changed.at(0).paragraph()->replace_text(text{ "Replaced" });
+  *doc.at(0).section() = section{ "Part 0" };
+  REQUIRE(live.refresh() == 2);
+  REQUIRE(live.string() == full(doc));
+
+  // a node built the same way as the one it replaced, swapped in through
+  // another kind, isn't taken for it
+  doc.at(3) = section_or_fragment{ paragraph{ "Interim" } };
+  doc.at(3) = section_or_fragment{ part(3, "other") };
+  REQUIRE(live.refresh() == 1);
+  REQUIRE(live.string() == full(doc));
+
+  REQUIRE(doc.remove(1));
+  REQUIRE(live.refresh() == 3);
+  REQUIRE(live.string() == full(doc));
+
+  // borrowed columns may change behind its back, so they render every time
+  std::vector<std::int64_t> ids{ 1, 2 };
+  doc.add(columnar_table{}.add_column("Id", ids));
+  REQUIRE(live.refresh() == 4);
+  ids[1] = 20;
+  REQUIRE(live.refresh() == 1);
+  REQUIRE(live.string() == full(doc));
+  live.invalidate();
+  REQUIRE(live.refresh() == 4);
+
+  // a shared section swapped in can't take the address of the one it replaced
+  auto legal = std::make_shared<section const>(part(9, "first"));
+  auto boilerplate = document{}.add(legal);
+  live_output shared{ md, boilerplate };
+  REQUIRE(shared.refresh() == 1);
+  auto next = part(9, "second");
+  legal.reset();
+  boilerplate.at(0) = section_or_fragment{ paragraph{ "Interim" } };
+  boilerplate.at(0) = section_or_fragment{ std::make_shared<section const>(std::move(next)) };
+  REQUIRE(shared.refresh() == 1);
+  REQUIRE(shared.string() == full(boilerplate));
+}